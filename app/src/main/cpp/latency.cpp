@@ -0,0 +1,92 @@
+#include "latency.h"
+
+#include <algorithm>
+#include <iomanip>
+
+struct LatencyStage {
+    const char *name;
+    int64_t FrameTiming::*from;
+    int64_t FrameTiming::*to;
+};
+
+static const LatencyStage stages[] = {
+        {"sensor-pose", &FrameTiming::sensorTime, &FrameTiming::poseTime},
+        {"pose-submit", &FrameTiming::poseTime, &FrameTiming::submitTime},
+        {"submit-gpu", &FrameTiming::submitTime, &FrameTiming::gpuTime},
+        {"gpu-present", &FrameTiming::gpuTime, &FrameTiming::presentTime},
+        {"scene-present", &FrameTiming::scenePoseTime, &FrameTiming::presentTime},
+        {"motion-photon", &FrameTiming::sensorTime, &FrameTiming::presentTime},
+};
+
+void writeFrameTiming(std::ostream &stream, const FrameTiming &timing) {
+    stream << "f " << timing.frame << ' ' << timing.sensorTime << ' ' << timing.scenePoseTime << ' '
+           << timing.poseTime << ' ' << timing.submitTime << ' ' << timing.gpuTime << ' ' << timing.presentTime
+           << ' ' << timing.startTime << ' ' << timing.deadline << '\n';
+}
+
+// One line per stage with the distribution in milliseconds, stages missing on this device are skipped
+void writeLatencySummary(std::ostream &stream, const std::vector<FrameTiming> &timings) {
+    for (auto &stage : stages) {
+        std::vector<int64_t> latencies;
+        for (auto &timing : timings)
+            if (timing.*stage.from && timing.*stage.to)
+                latencies.push_back(timing.*stage.to - timing.*stage.from);
+
+        if (latencies.empty())
+            continue;
+
+        std::sort(latencies.begin(), latencies.end());
+        double sum = 0.0;
+        for (auto latency : latencies)
+            sum += latency;
+
+        auto percentile = [&latencies](double fraction) {
+            return latencies[std::min((size_t) (fraction * latencies.size()), latencies.size() - 1)] * 1e-6;
+        };
+
+        stream << "s " << stage.name << ' ' << latencies.size() << std::fixed << std::setprecision(3) << ' '
+               << sum / latencies.size() * 1e-6 << ' ' << percentile(0.5) << ' ' << percentile(0.9) << ' '
+               << percentile(0.99) << ' ' << latencies.back() * 1e-6 << '\n';
+        stream.unsetf(std::ios::fixed);
+    }
+}
+
+// Latches the newest gyroscope sample a fixed lead before every vsync and walks it through the model
+std::vector<FrameTiming> replayLatency(const std::vector<SensorRecord> &records, const LatencyModel &model) {
+    std::vector<int64_t> samples;
+    for (auto &record : records)
+        if (record.type == SENSOR_GYROSCOPE)
+            samples.push_back(record.timestamp);
+
+    std::vector<FrameTiming> timings;
+    if (samples.empty() || model.refreshPeriod <= 0)
+        return timings;
+
+    uint32_t frame = 0;
+    for (int64_t vsync = samples.front() + model.refreshPeriod; vsync <= samples.back();
+         vsync += model.refreshPeriod) {
+        int64_t latch = vsync - model.latchLead;
+        auto next = std::upper_bound(samples.begin(), samples.end(), latch);
+        if (next == samples.begin())
+            continue;
+
+        FrameTiming timing{};
+        timing.frame = ++frame;
+        timing.sensorTime = *(next - 1);
+        timing.startTime = latch;
+        timing.poseTime = latch;
+        timing.scenePoseTime = latch - model.sceneAge;
+        timing.submitTime = latch + model.submitDelay;
+        timing.gpuTime = timing.submitTime + model.gpuDelay;
+
+        int64_t presented = vsync;
+        while (presented < timing.gpuTime)
+            presented += model.refreshPeriod;
+        timing.presentTime = presented;
+        timing.deadline = vsync;
+
+        timings.push_back(timing);
+    }
+
+    return timings;
+}
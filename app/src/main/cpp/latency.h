@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <iostream>
+
+#include "tracking.h"
+
+// Nanoseconds on the monotonic clock, zero when a stage could not be measured on this device
+struct FrameTiming {
+    uint32_t frame;
+    int64_t sensorTime;
+    int64_t scenePoseTime;
+    int64_t poseTime;
+    int64_t submitTime;
+    int64_t gpuTime;
+    int64_t presentTime;
+    int64_t startTime;
+    int64_t deadline;
+};
+
+// Simulated pipeline used to replay sensor logs, delays are measured from the pose latch
+struct LatencyModel {
+    int64_t refreshPeriod;
+    int64_t latchLead;
+    int64_t submitDelay;
+    int64_t gpuDelay;
+    int64_t sceneAge;
+};
+
+void writeFrameTiming(std::ostream &stream, const FrameTiming &timing);
+void writeLatencySummary(std::ostream &stream, const std::vector<FrameTiming> &timings);
+std::vector<FrameTiming> replayLatency(const std::vector<SensorRecord> &records, const LatencyModel &model);
@@ -1,9 +1,22 @@
 #include <jni.h>
 
 #include <vector>
+#include <deque>
+#include <map>
+#include <tuple>
+#include <unordered_map>
+#include <string>
+#include <algorithm>
 #include <fstream>
+#include <sstream>
 #include <iostream>
 #include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cfloat>
+#include <ctime>
 
 #include <android_native_app_glue.h>
 #include <android/log.h>
@@ -19,6 +32,14 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "trajectory.h"
+#include "tracking.h"
+#include "latency.h"
+#include "pacing.h"
+#include "occlusion.h"
+#include "rendergraph.h"
+#include "vertexformat.h"
+
 #define TAG "MoleculeVRNativeMain"
 #define LOG(...) ((void)__android_log_print(ANDROID_LOG_INFO, TAG, __VA_ARGS__))
 
@@ -32,9 +53,138 @@ struct Transform {
     glm::mat4 left;
     glm::mat4 right;
     glm::mat4 proj;
+    glm::uvec4 playback;
+    glm::vec4 keyframe;
+};
+
+struct WarpTransform {
+    glm::mat4 reprojection[2];
+    glm::vec4 foveation;
+    glm::vec4 resolution;
+};
+
+struct OcclusionBake {
+    glm::vec4 origin;
+    glm::uvec4 dimensions;
+    glm::vec4 settings;
+};
+
+struct DrawConstants {
+    glm::vec4 offset;
+    glm::vec4 scale;
+    glm::vec4 highlight;
+    uint32_t animated;
+    float opacity;
+    uint32_t eye;
+};
+
+struct ScreenOcclusion {
+    glm::mat4 inverseProjection;
+    glm::vec4 foveation;
+    glm::vec4 parameters;
+    glm::vec4 projection;
+};
+
+struct DistortionVertex {
+    glm::vec2 position;
+    glm::vec2 red;
+    glm::vec2 green;
+    glm::vec2 blue;
+};
+
+// Radial lens model in tangent angle space, channel scales model the lens dispersion
+struct ViewerProfile {
+    float k1;
+    float k2;
+    float redScale;
+    float blueScale;
+    float lensOffset;
+};
+
+struct ChunkFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t chunkCount;
+    uint32_t maxVertices;
+    uint32_t maxIndices;
+};
+
+struct ChunkFileRecord {
+    float minimum[3];
+    float maximum[3];
+    uint64_t offset;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+};
+
+struct Chunk {
+    glm::vec3 minimum;
+    glm::vec3 maximum;
+    uint64_t offset;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    int32_t slot;
+    bool pending;
+    float priority;
+};
+
+struct ChunkData {
+    uint32_t chunk;
+    std::vector<uint8_t> vertices;
+    std::vector<uint16_t> indices;
+    std::vector<uint8_t> occlusion;
+};
+
+// Value is the last one handed out for signaling, the counter on the device trails it until the queue catches up.
+// Without timeline semaphores each submission in flight owns a ring slot with a fence the host can wait on and a
+// binary semaphore a single queue wait can consume, completed is then tracked on the host
+struct Timeline {
+    VkSemaphore semaphore;
+    uint64_t value;
+    uint64_t completed;
+    std::vector<VkFence> fences;
+    std::vector<VkSemaphore> signals;
+    std::vector<bool> consumed;
+};
+
+// Swapchain waits have no timeline and name their binary semaphore instead, the value is ignored for them
+struct TimelineWait {
+    Timeline *timeline;
+    VkSemaphore semaphore;
+    uint64_t value;
+    VkPipelineStageFlags stages;
+};
+
+// Everything a queued dispatch holds on to until the compute timeline reaches its value
+struct ComputeJob {
+    VkCommandBuffer commandBuffer;
+    uint64_t value;
+    VkShaderModule shader;
+    VkDescriptorSetLayout setLayout;
+    VkPipelineLayout layout;
+    VkPipeline pipeline;
+    VkDescriptorPool pool;
+    std::vector<VkBuffer> buffers;
+    std::vector<VkDeviceMemory> memories;
+};
+
+struct RecordTask {
+    uint32_t subpass;
+    uint32_t eye;
+    bool assembly;
+    uint32_t firstSlot;
+    uint32_t slotCount;
+};
+
+typedef std::vector<std::map<std::string, std::string>> CifRows;
+
+struct RecordWorker {
+    std::vector<VkCommandPool> pools;
+    std::vector<std::vector<VkCommandBuffer>> buffers;
+    std::thread thread;
 };
 
-std::vector<Vertex> vertices, vertexData = {
+std::vector<Vertex> vertexData = {
         {{-0.5f, -0.5f, -0.5f}, {1.0f, 0.0f, 0.0f}},
         {{0.5f,  -0.5f, -0.5f}, {0.0f, 1.0f, 0.0f}},
         {{0.5f,  0.5f,  -0.5f}, {0.0f, 0.0f, 1.0f}},
@@ -46,43 +196,290 @@ std::vector<Vertex> vertices, vertexData = {
         {{-0.5f, 0.5f,  -1.0f}, {1.0f, 1.0f, 1.0f}}
 };
 
-std::vector<uint16_t> indices, indexData = {
+std::vector<uint32_t> indexData = {
         0, 1, 2, 2, 3, 0,
         4, 5, 6, 6, 7, 4
 };
 
 android_app *app;
-ASensorEventQueue *sensorQueue;
+SensorQueue sensorRecords;
+std::atomic<ALooper *> sensorLooper;
+std::thread sensorThread, renderThread;
+std::atomic<bool> sensorRunning, rendering;
+HeadTracker tracker;
+PosePredictor predictor;
+const bool recordSensors = false;
+std::ofstream sensorLog;
 VkInstance instance;
 VkDebugUtilsMessengerEXT messenger;
 VkSurfaceKHR surface;
 VkPhysicalDevice physicalDevice;
 VkDevice device;
-VkQueue queue;
+VkQueue queue, warpQueue;
 VkCommandPool commandPool;
+
+// Streaming uploads and the structure bake go to dedicated families when the device has them,
+// buffers they write change owner through release and acquire barriers
+uint32_t graphicsFamily, computeFamily, transferFamily;
+VkQueue computeQueue, transferQueue;
+VkCommandPool computePool, transferPool;
+std::vector<VkBufferMemoryBarrier> uploadReleases;
 VkSwapchainKHR swapchain;
+bool displayTimingSupported;
+PFN_vkGetPastPresentationTimingGOOGLE getPastPresentationTiming;
+PFN_vkGetRefreshCycleDurationGOOGLE getRefreshCycleDuration;
+uint32_t presentId;
+uint64_t poseTime, cullPoseTime;
+int64_t sensorTime;
+float presentLatency;
+double latchGain, latchDelay;
+uint32_t sceneLatchCount, latchCount;
+std::deque<FrameTiming> presentFrames;
+
+// Frames start late enough to finish right before their vsync, zero targetRate follows the display
+uint32_t targetRate;
+FramePacer pacer;
+int64_t frameStartTime;
+
+// Warp completion is read back per swapchain image and moved onto the CPU clock when calibration exists
+bool recordLatency;
+const uint32_t latencySummaryFrames = 600;
+std::ofstream latencyLog;
+std::vector<FrameTiming> latencyHistory;
+bool calibratedTimestampsSupported;
+PFN_vkGetCalibratedTimestampsEXT getCalibratedTimestamps;
+VkQueryPool warpTimestampPool;
+std::vector<uint32_t> imageFrames;
+std::vector<int64_t> eyePoseTimes;
 VkExtent2D swapchainExtent;
-uint32_t imageCount, currentImage;
+uint32_t imageCount;
 std::vector<VkImage> swapchainImages;
 std::vector<VkImageView> swapchainViews;
 VkShaderModule vertexShader, fragmentShader;
 VkRenderPass renderPass;
 VkDescriptorSetLayout descriptorSetLayout;
 VkPipelineLayout pipelineLayout;
-VkPipeline leftGraphicsPipeline, rightGraphicsPipeline;
+VkPipeline graphicsPipeline;
+
+// Scene attachments in framebuffer order, load and store ops and memory follow from how the graph uses them
+const uint32_t colorAttachment = 0, depthAttachment = 1, resolveAttachment = 2, accumulationAttachment = 3,
+        revealageAttachment = 4;
+RenderGraph sceneGraph, warpGraph;
 std::vector<VkFramebuffer> framebuffers;
-VkImage depthImage, colorImage;
-VkImageView depthView, colorView;
-VkDeviceMemory depthMemory, colorMemory;
+VkImage colorImage;
+VkImageView colorView;
+VkDeviceMemory colorMemory;
+
+// Selected representations are tinted toward rgb by a, pushed per draw so selection never touches pipelines
+glm::vec4 assemblyHighlight(1.0f, 0.8f, 0.2f, 0.0f), chunkHighlight(1.0f, 0.8f, 0.2f, 0.0f);
+
+// Translucent chunks are accumulated order independently and composited over the opaque scene in a last subpass,
+// per-pixel fragment lists sort up to 16 layers exactly when the device can store from fragment shaders
+const float surfaceOpacity = 0.6f;
+const bool fragmentListsRequested = false;
+const uint32_t fragmentListDepth = 4;
+bool fragmentListsEnabled;
+VkShaderModule transparentShader, compositeVertexShader, compositeFragmentShader;
+VkPipeline transparentPipeline, compositePipeline;
+VkImage accumulationImage, revealageImage, fragmentHeadImage;
+VkImageView accumulationView, revealageView, fragmentHeadView;
+VkDeviceMemory accumulationMemory, revealageMemory, fragmentHeadMemory;
+VkBuffer fragmentBuffer;
+VkDeviceMemory fragmentMemory;
 VkBuffer vertexBuffer, indexBuffer;
 VkDeviceMemory vertexMemory, indexMemory;
+
+// Positions are quantized to the bounds of their buffer, colors index a palette shared by the structure and chunks
+const std::vector<VertexElement> vertexElements{{ATTRIBUTE_POSITION, 0, ENCODING_QUANTIZED, 0},
+                                                {ATTRIBUTE_COLOR, 1, ENCODING_PALETTE16, 0}};
+const uint32_t paletteCapacity = 4096;
+VertexLayout assemblyLayout = createVertexLayout(vertexElements), chunkLayout = assemblyLayout;
+ColorPalette palette{{}, {}, paletteCapacity};
+std::mutex paletteMutex;
+VkBuffer paletteBuffer;
+VkDeviceMemory paletteMemory;
+glm::vec4 *paletteMapping;
+
+// Ambient occlusion is baked per vertex for the structure and every streamed chunk, radius in structure units
+const bool occlusionCompute = true;
+const OcclusionSettings occlusionSettings{4.0f, 8.0f, 0.6f};
+VkBuffer occlusionBuffer;
+VkDeviceMemory occlusionMemory;
+ComputeJob occlusionJob;
+bool occlusionPending;
 std::vector<VkBuffer> uniformBuffers;
 std::vector<VkDeviceMemory> uniformMemories;
+std::vector<void *> uniformMappings;
 VkDescriptorPool descriptorPool;
 std::vector<VkDescriptorSet> descriptorSets;
 std::vector<VkCommandBuffer> commandBuffers;
-std::vector<VkFence> frameFences, orderFences;
-std::vector<VkSemaphore> availableSemaphores, finishedSemaphores;
+
+// Scene draws are recorded every frame into secondary buffers, each worker owns a pool per eye image
+const uint32_t recordWorkerLimit = 4, chunkGroupSize = 32;
+std::vector<RecordWorker> recordWorkers;
+std::vector<RecordTask> recordTasks;
+std::vector<VkCommandBuffer> recordResults;
+size_t recordImage;
+std::atomic<uint32_t> recordNext;
+uint32_t recordGeneration, recordBusy;
+bool recordRunning;
+std::mutex recordMutex;
+std::condition_variable recordCondition, recordFinished;
+
+// Each queue role signals its own timeline once per submission, so waits name the exact submission they need.
+// Acquire semaphores cycle through the frames in flight, independent of how many images the swapchain has
+const uint32_t framesInFlight = 2;
+const uint32_t timelineDepth = 8;
+bool timelineSupported;
+PFN_vkWaitSemaphoresKHR waitTimelineSemaphores;
+PFN_vkGetSemaphoreCounterValueKHR getTimelineValue;
+Timeline sceneTimeline, warpTimeline, computeTimeline, transferTimeline;
+std::vector<uint64_t> imageValues;
+std::vector<VkSemaphore> acquireSemaphores, presentSemaphores;
+uint32_t currentFrame;
+
+VkPhysicalDeviceFeatures deviceFeatures;
+
+// Tiers trade samples and depth precision for bandwidth, devices with lazily allocated memory default to the middle
+const std::vector<VkSampleCountFlagBits> tierSamples{VK_SAMPLE_COUNT_2_BIT, VK_SAMPLE_COUNT_4_BIT,
+                                                     VK_SAMPLE_COUNT_8_BIT};
+const std::vector<std::vector<VkFormat>> tierDepthFormats{
+        {VK_FORMAT_D16_UNORM, VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D32_SFLOAT},
+        {VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D16_UNORM},
+        {VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D16_UNORM}};
+int32_t qualitySetting;
+uint32_t qualityTier;
+VkSampleCountFlagBits sampleCount;
+VkFormat depthFormat;
+
+const uint32_t eyeImageCount = 2;
+
+// Each eye keeps full density inside foveaExtent of its NDC range and peripheryDensity outside it
+const bool foveationEnabled = true;
+const float foveaExtent = 0.5f, peripheryDensity = 0.5f;
+bool densityMapSupported, multiResolution;
+VkExtent2D eyeExtent, densityTexelSize;
+VkExtent2D densityExtent;
+std::vector<VkImage> densityImages;
+std::vector<VkImageView> densityViews;
+std::vector<VkDeviceMemory> densityMemories;
+std::vector<VkBuffer> densityStagingBuffers;
+std::vector<VkDeviceMemory> densityStagingMemories;
+std::vector<void *> densityStagingMappings;
+bool densityUploadPending;
+
+// Eye images are drawn into their top left renderScale fraction, chosen from scene GPU time.
+// Each eye writes three timestamps, the middle one splits off the screen-space occlusion pass
+const float minimumScale = 0.5f, scaleStep = 0.05f;
+const uint32_t eyeTimestamps = 3;
+float renderScale, sceneTime, sceneTimeBudget, ssaoTime, timestampPeriod;
+uint32_t scaleCooldown;
+bool timestampsSupported;
+VkQueryPool timestampPool;
+std::vector<float> eyeScales;
+std::vector<bool> timestampsWritten;
+
+std::vector<VkImage> eyeColorImages, eyeDepthImages;
+std::vector<VkImageView> eyeColorViews, eyeDepthViews;
+std::vector<VkDeviceMemory> eyeColorMemories, eyeDepthMemories;
+
+// Animated structures get screen-space occlusion from the stored depth at half resolution, radius in view units
+const float ssaoRadius = 0.5f, ssaoIntensity = 1.5f, ssaoBias = 0.002f;
+bool ssaoEnabled;
+VkExtent2D ssaoExtent;
+std::vector<VkImage> eyeOcclusionImages;
+std::vector<VkImageView> eyeOcclusionViews;
+std::vector<VkDeviceMemory> eyeOcclusionMemories;
+VkShaderModule ssaoShader;
+VkDescriptorSetLayout ssaoDescriptorSetLayout;
+VkPipelineLayout ssaoPipelineLayout;
+VkPipeline ssaoPipeline;
+VkDescriptorPool ssaoDescriptorPool;
+std::vector<VkDescriptorSet> ssaoDescriptorSets;
+VkSampler eyeSampler;
+VkRenderPass warpRenderPass;
+VkShaderModule warpVertexShader, warpFragmentShader;
+VkDescriptorSetLayout warpDescriptorSetLayout;
+VkPipelineLayout warpPipelineLayout;
+VkPipeline warpPipeline;
+ViewerProfile viewerProfile;
+const uint32_t distortionResolution = 32;
+VkBuffer distortionVertexBuffer, distortionIndexBuffer;
+VkDeviceMemory distortionVertexMemory, distortionIndexMemory;
+uint32_t distortionVertexCount, distortionIndexCount;
+std::vector<VkFramebuffer> warpFramebuffers;
+std::vector<VkBuffer> warpBuffers;
+std::vector<VkDeviceMemory> warpMemories;
+std::vector<void *> warpMappings;
+VkDescriptorPool warpDescriptorPool;
+std::vector<VkDescriptorSet> warpDescriptorSets;
+std::vector<VkCommandBuffer> warpCommandBuffers;
+std::vector<uint64_t> sceneValues, eyeReleaseValues;
+std::vector<glm::mat4> eyeViews;
+glm::mat4 eyeProjection;
+uint32_t sceneIndex, displayedEye;
+bool sceneSubmitted, eyeReady;
+
+const uint32_t chunkVertexLimit = 16384, chunkIndexLimit = 49152, chunkRequestLimit = 8;
+const VkDeviceSize chunkMemoryBudget = 64 << 20, chunkUploadBudget = 4 << 20;
+const float chunkStreamDistance = 50.0f, chunkCellSize = 16.0f, atomRadius = 0.4f;
+const uint32_t importedAtomVertices = 6;
+// Imported structures up to this many vertices replace the demo in vertexData, larger ones are streamed as chunks
+const uint32_t residentVertexLimit = 1 << 21;
+bool structureResident, structureStreamed;
+
+std::string chunkPath;
+std::vector<Chunk> chunks;
+std::vector<int32_t> chunkSlots;
+uint32_t chunkMaxVertices, chunkMaxIndices;
+VkBuffer chunkVertexBuffer, chunkIndexBuffer;
+VkDeviceMemory chunkVertexMemory, chunkIndexMemory;
+VkBuffer chunkOcclusionBuffer;
+VkDeviceMemory chunkOcclusionMemory;
+std::vector<VkBuffer> chunkStagingBuffers;
+std::vector<VkDeviceMemory> chunkStagingMemories;
+std::vector<void *> chunkStagingMappings;
+std::vector<VkCommandBuffer> uploadCommandBuffers;
+std::deque<ChunkData> chunkUploads;
+std::thread streamThread;
+std::mutex streamMutex;
+std::condition_variable streamCondition;
+std::deque<uint32_t> streamRequests;
+std::deque<ChunkData> streamResults;
+bool streamRunning;
+std::vector<glm::mat4> assemblyOperators, visibleOperators;
+glm::vec3 assemblyCenter;
+float assemblyRadius;
+std::vector<VkBuffer> instanceBuffers, indirectBuffers;
+std::vector<VkDeviceMemory> instanceMemories, indirectMemories;
+std::vector<void *> instanceMappings, indirectMappings;
+const uint32_t trajectorySlotCount = 8;
+const uint32_t positionSlotCount = 3;
+// Glyph vertices of one atom are consecutive, the demo draws each atom as a single vertex
+uint32_t atomVertices = 1;
+const float trajectoryKeyframeRate = 10.0f;
+
+TrajectoryPlayer player;
+bool trajectoryLoaded;
+
+// Touches arrive on the main thread, the render thread picks up the latest position before playback
+std::atomic<float> seekPosition(-1.0f);
+VkBuffer positionBuffer;
+VkDeviceMemory positionMemory;
+std::vector<VkBuffer> trajectoryStagingBuffers;
+std::vector<VkDeviceMemory> trajectoryStagingMemories;
+std::vector<int32_t> trajectoryReleases;
+uint32_t positionSlot, previousSlot;
+uint32_t keyframeNumber;
+bool keyframeLoaded;
+float keyframeTime;
+glm::vec3 keyframeMinimum, keyframeMaximum;
+std::chrono::steady_clock::time_point playbackTime;
+bool uploadRecording;
+
+// Culling tests each eye with a field of view widened by how far the head may turn before the warp catches up
+const float cullAngle = glm::radians(10.0f);
+glm::mat4 cullMatrices[2];
 
 static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
         VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
@@ -109,7 +506,7 @@ static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
     return VK_FALSE;
 }
 
-//TODO: use multiview extension instead of hard coded pipelines
+//TODO: use multiview extension to record both eyes in one pass instead of a draw per eye
 void initialize() {
     std::vector<const char *> layers, extensions;
     layers.push_back("VK_LAYER_KHRONOS_validation");
@@ -156,29 +553,368 @@ void initialize() {
     vkCreateAndroidSurfaceKHR(instance, &surfaceInfo, nullptr, &surface);
 }
 
-void pickDevice() {
+// Picks the family with the fewest capabilities beyond the required ones, so dedicated families win
+uint32_t findQueueFamily(const std::vector<VkQueueFamilyProperties> &families, VkQueueFlags required,
+                         uint32_t fallback) {
+    VkQueueFlags roles = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT;
+    uint32_t chosen = fallback;
+    int chosenExtra = INT32_MAX;
+
+    for (uint32_t i = 0; i < families.size(); i++) {
+        if (families[i].queueCount == 0 || (families[i].queueFlags & required) != required)
+            continue;
+
+        int extra = glm::bitCount((int) (families[i].queueFlags & roles & ~required));
+        if (extra < chosenExtra) {
+            chosen = i;
+            chosenExtra = extra;
+        }
+    }
+
+    return chosen;
+}
+
+VkBufferMemoryBarrier ownershipBarrier(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, uint32_t source,
+                                       uint32_t destination) {
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = source;
+    barrier.dstQueueFamilyIndex = destination;
+    barrier.buffer = buffer;
+    barrier.offset = offset;
+    barrier.size = size;
+    return barrier;
+}
+
+VkSemaphore createBinarySemaphore() {
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    VkSemaphore semaphore;
+    vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore);
+    return semaphore;
+}
+
+Timeline createTimeline() {
+    Timeline timeline{};
+
+    if (!timelineSupported) {
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+        timeline.fences.resize(timelineDepth);
+        timeline.signals.resize(timelineDepth);
+        timeline.consumed.assign(timelineDepth, true);
+        for (uint32_t slot = 0; slot < timelineDepth; slot++) {
+            vkCreateFence(device, &fenceInfo, nullptr, &timeline.fences[slot]);
+            timeline.signals[slot] = createBinarySemaphore();
+        }
+        return timeline;
+    }
+
+    VkSemaphoreTypeCreateInfoKHR typeInfo{};
+    typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+    typeInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreInfo.pNext = &typeInfo;
+
+    vkCreateSemaphore(device, &semaphoreInfo, nullptr, &timeline.semaphore);
+    return timeline;
+}
+
+void destroyTimeline(Timeline &timeline) {
+    vkDestroySemaphore(device, timeline.semaphore, nullptr);
+    for (auto fence : timeline.fences)
+        vkDestroyFence(device, fence, nullptr);
+    for (auto semaphore : timeline.signals)
+        vkDestroySemaphore(device, semaphore, nullptr);
+    timeline = {};
+}
+
+// A fence covers everything submitted to its queue before it, so the first unsignaled one ends the scan
+uint64_t timelineValue(Timeline &timeline) {
+    if (!timelineSupported) {
+        while (timeline.completed < timeline.value &&
+               vkGetFenceStatus(device, timeline.fences[(timeline.completed + 1) % timelineDepth]) == VK_SUCCESS)
+            timeline.completed++;
+        return timeline.completed;
+    }
+
+    uint64_t value;
+    getTimelineValue(device, timeline.semaphore, &value);
+    return value;
+}
+
+// Value zero is where every timeline starts, so it stands for nothing to wait on
+void waitTimeline(Timeline &timeline, uint64_t value) {
+    if (value == 0)
+        return;
+
+    if (!timelineSupported) {
+        if (value <= timeline.completed)
+            return;
+        vkWaitForFences(device, 1, &timeline.fences[value % timelineDepth], VK_TRUE, UINT64_MAX);
+        timeline.completed = value;
+        return;
+    }
+
+    VkSemaphoreWaitInfoKHR waitInfo{};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &timeline.semaphore;
+    waitInfo.pValues = &value;
+
+    waitTimelineSemaphores(device, &waitInfo, UINT64_MAX);
+}
+
+// Signals the next value of the timeline, plus a binary semaphore when the submission feeds a present.
+// Without timelines a wait that is already met is dropped, the first queue wait on a value consumes its binary
+// semaphore and any later one falls back to the fence on the host
+uint64_t submitTimeline(VkQueue submitQueue, Timeline &timeline, const std::vector<VkCommandBuffer> &submitBuffers,
+                        const std::vector<TimelineWait> &waits, VkSemaphore presentSemaphore = VK_NULL_HANDLE) {
+    std::vector<VkSemaphore> waitSemaphores, signalSemaphores;
+    std::vector<uint64_t> waitValues, signalValues;
+    std::vector<VkPipelineStageFlags> waitStages;
+    VkFence fence = VK_NULL_HANDLE;
+
+    uint64_t value = ++timeline.value;
+    if (timelineSupported) {
+        signalSemaphores.push_back(timeline.semaphore);
+        signalValues.push_back(value);
+    } else {
+        uint32_t slot = value % timelineDepth;
+        if (value > timelineDepth)
+            waitTimeline(timeline, value - timelineDepth);
+
+        // A signal nobody waited on leaves the semaphore signaled, and it cannot be signaled again
+        if (!timeline.consumed[slot]) {
+            vkDestroySemaphore(device, timeline.signals[slot], nullptr);
+            timeline.signals[slot] = createBinarySemaphore();
+        }
+
+        fence = timeline.fences[slot];
+        vkResetFences(device, 1, &fence);
+        timeline.consumed[slot] = false;
+        signalSemaphores.push_back(timeline.signals[slot]);
+        signalValues.push_back(0);
+    }
+
+    for (auto &wait : waits) {
+        VkSemaphore semaphore = wait.semaphore;
+
+        if (wait.timeline && timelineSupported) {
+            semaphore = wait.timeline->semaphore;
+        } else if (wait.timeline) {
+            Timeline &source = *wait.timeline;
+            if (wait.value == 0 || timelineValue(source) >= wait.value)
+                continue;
+
+            uint32_t slot = wait.value % timelineDepth;
+            if (source.consumed[slot]) {
+                waitTimeline(source, wait.value);
+                continue;
+            }
+            source.consumed[slot] = true;
+            semaphore = source.signals[slot];
+        }
+
+        waitSemaphores.push_back(semaphore);
+        waitValues.push_back(wait.value);
+        waitStages.push_back(wait.stages);
+    }
+
+    if (presentSemaphore != VK_NULL_HANDLE) {
+        signalSemaphores.push_back(presentSemaphore);
+        signalValues.push_back(0);
+    }
+
+    VkTimelineSemaphoreSubmitInfoKHR timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+    timelineInfo.waitSemaphoreValueCount = waitValues.size();
+    timelineInfo.pWaitSemaphoreValues = waitValues.data();
+    timelineInfo.signalSemaphoreValueCount = signalValues.size();
+    timelineInfo.pSignalSemaphoreValues = signalValues.data();
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = timelineSupported ? &timelineInfo : nullptr;
+    submitInfo.waitSemaphoreCount = waitSemaphores.size();
+    submitInfo.pWaitSemaphores = waitSemaphores.data();
+    submitInfo.pWaitDstStageMask = waitStages.data();
+    submitInfo.commandBufferCount = submitBuffers.size();
+    submitInfo.pCommandBuffers = submitBuffers.data();
+    submitInfo.signalSemaphoreCount = signalSemaphores.size();
+    submitInfo.pSignalSemaphores = signalSemaphores.data();
+
+    vkQueueSubmit(submitQueue, 1, &submitInfo, fence);
+    return value;
+}
+
+bool pickDevice() {
     uint32_t deviceCount;
     vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
     std::vector<VkPhysicalDevice> physicalDevices(deviceCount);
     vkEnumeratePhysicalDevices(instance, &deviceCount, physicalDevices.data());
     physicalDevice = physicalDevices.at(0);
 
-    float queuePriority = 1.0f;
-    VkPhysicalDeviceFeatures deviceFeatures{};
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+
+    uint32_t familyCount;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+
+    graphicsFamily = findQueueFamily(families, VK_QUEUE_GRAPHICS_BIT, 0);
+    computeFamily = findQueueFamily(families, VK_QUEUE_COMPUTE_BIT, graphicsFamily);
+    transferFamily = findQueueFamily(families, VK_QUEUE_TRANSFER_BIT, graphicsFamily);
+    LOG("Queue families: graphics %u, compute %u, transfer %u\n", graphicsFamily, computeFamily, transferFamily);
+
+    // Reprojection gets its own queue at higher priority when the family has a second one
+    std::vector<float> queuePriorities{0.5f, 1.0f};
+    if (families[graphicsFamily].queueCount < 2)
+        queuePriorities = {1.0f};
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+    timestampsSupported = families[graphicsFamily].timestampValidBits > 0 && deviceProperties.limits.timestampPeriod > 0.0f;
+    timestampPeriod = deviceProperties.limits.timestampPeriod;
+
+    deviceFeatures = {};
+    deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+    fragmentListsEnabled = fragmentListsRequested && supportedFeatures.fragmentStoresAndAtomics;
+    deviceFeatures.fragmentStoresAndAtomics = fragmentListsEnabled;
     std::vector<const char *> deviceLayers, deviceExtensions;
     deviceLayers.push_back("VK_LAYER_KHRONOS_validation");
     deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
 
-    VkDeviceQueueCreateInfo queueInfo{};
-    queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    queueInfo.queueFamilyIndex = 0;
-    queueInfo.queueCount = 1;
-    queueInfo.pQueuePriorities = &queuePriority;
+    uint32_t extensionCount;
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> extensionProperties(extensionCount);
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount,
+                                         extensionProperties.data());
+
+    displayTimingSupported = false;
+    for (auto &properties : extensionProperties)
+        if (strcmp(properties.extensionName, VK_GOOGLE_DISPLAY_TIMING_EXTENSION_NAME) == 0)
+            displayTimingSupported = true;
+
+    if (displayTimingSupported)
+        deviceExtensions.push_back(VK_GOOGLE_DISPLAY_TIMING_EXTENSION_NAME);
+
+    calibratedTimestampsSupported = false;
+    for (auto &properties : extensionProperties)
+        if (timestampsSupported &&
+                strcmp(properties.extensionName, VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME) == 0)
+            calibratedTimestampsSupported = true;
+
+    // Present times are on the monotonic clock, so GPU timestamps are only useful if they calibrate to it
+    if (calibratedTimestampsSupported) {
+        auto getTimeDomains = (PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT) vkGetInstanceProcAddr(
+                instance, "vkGetPhysicalDeviceCalibrateableTimeDomainsEXT");
+        uint32_t domainCount = 0;
+        if (getTimeDomains)
+            getTimeDomains(physicalDevice, &domainCount, nullptr);
+        std::vector<VkTimeDomainEXT> domains(domainCount);
+        if (domainCount)
+            getTimeDomains(physicalDevice, &domainCount, domains.data());
+
+        calibratedTimestampsSupported =
+                std::find(domains.begin(), domains.end(), VK_TIME_DOMAIN_DEVICE_EXT) != domains.end() &&
+                std::find(domains.begin(), domains.end(), VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT) != domains.end();
+    }
+
+    if (calibratedTimestampsSupported)
+        deviceExtensions.push_back(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+
+    // Older drivers lack timelines, frame synchronization then runs on fences and binary semaphores
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures{};
+    timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+
+    timelineSupported = false;
+    for (auto &properties : extensionProperties)
+        if (strcmp(properties.extensionName, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME) == 0)
+            timelineSupported = true;
+
+    if (timelineSupported) {
+        VkPhysicalDeviceFeatures2 features{};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &timelineFeatures;
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+        timelineSupported = timelineFeatures.timelineSemaphore;
+    }
+
+    if (timelineSupported)
+        deviceExtensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+    else
+        LOG("Timeline semaphores are not supported, falling back to fences\n");
+    timelineFeatures = {};
+    timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+    timelineFeatures.timelineSemaphore = VK_TRUE;
+
+    VkPhysicalDeviceFragmentDensityMapFeaturesEXT densityFeatures{};
+    densityFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FRAGMENT_DENSITY_MAP_FEATURES_EXT;
+
+    densityMapSupported = false;
+    for (auto &properties : extensionProperties)
+        if (strcmp(properties.extensionName, VK_EXT_FRAGMENT_DENSITY_MAP_EXTENSION_NAME) == 0)
+            densityMapSupported = true;
+
+    if (densityMapSupported) {
+        VkPhysicalDeviceFeatures2 features{};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &densityFeatures;
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+
+        VkPhysicalDeviceFragmentDensityMapPropertiesEXT densityProperties{};
+        densityProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FRAGMENT_DENSITY_MAP_PROPERTIES_EXT;
+
+        VkPhysicalDeviceProperties2 properties{};
+        properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties.pNext = &densityProperties;
+        vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+        densityMapSupported = densityFeatures.fragmentDensityMap;
+        densityTexelSize = densityProperties.minFragmentDensityTexelSize;
+        densityFeatures = {};
+        densityFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FRAGMENT_DENSITY_MAP_FEATURES_EXT;
+        densityFeatures.fragmentDensityMap = VK_TRUE;
+    }
+
+    // Without density maps the periphery is drawn through smaller viewports into a packed eye image
+    densityMapSupported = densityMapSupported && foveationEnabled;
+    multiResolution = foveationEnabled && !densityMapSupported;
+    if (densityMapSupported)
+        deviceExtensions.push_back(VK_EXT_FRAGMENT_DENSITY_MAP_EXTENSION_NAME);
+
+    std::vector<VkDeviceQueueCreateInfo> queueInfos(1);
+    queueInfos[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueInfos[0].queueFamilyIndex = graphicsFamily;
+    queueInfos[0].queueCount = queuePriorities.size();
+    queueInfos[0].pQueuePriorities = queuePriorities.data();
+
+    // Compute and transfer may share one family, then they share its queue as well
+    float asyncPriority = 0.5f;
+    for (uint32_t family : {computeFamily, transferFamily}) {
+        if (family == graphicsFamily || queueInfos.back().queueFamilyIndex == family)
+            continue;
+
+        VkDeviceQueueCreateInfo asyncInfo = queueInfos[0];
+        asyncInfo.queueFamilyIndex = family;
+        asyncInfo.queueCount = 1;
+        asyncInfo.pQueuePriorities = &asyncPriority;
+        queueInfos.push_back(asyncInfo);
+    }
+
+    timelineFeatures.pNext = densityMapSupported ? &densityFeatures : nullptr;
 
     VkDeviceCreateInfo deviceInfo{};
     deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    deviceInfo.queueCreateInfoCount = 1;
-    deviceInfo.pQueueCreateInfos = &queueInfo;
+    deviceInfo.pNext = timelineSupported ? (void *) &timelineFeatures : timelineFeatures.pNext;
+    deviceInfo.queueCreateInfoCount = queueInfos.size();
+    deviceInfo.pQueueCreateInfos = queueInfos.data();
     deviceInfo.pEnabledFeatures = &deviceFeatures;
     deviceInfo.enabledLayerCount = deviceLayers.size();
     deviceInfo.ppEnabledLayerNames = deviceLayers.data();
@@ -187,11 +923,50 @@ void pickDevice() {
 
     VkCommandPoolCreateInfo poolInfo{};
     poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    poolInfo.queueFamilyIndex = 0;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = graphicsFamily;
 
-    vkCreateDevice(physicalDevice, &deviceInfo, nullptr, &device);
-    vkGetDeviceQueue(device, 0, 0, &queue);
+    if (vkCreateDevice(physicalDevice, &deviceInfo, nullptr, &device) != VK_SUCCESS) {
+        LOG("Failed to create the logical device\n");
+        return false;
+    }
+
+    if (displayTimingSupported) {
+        getPastPresentationTiming = (PFN_vkGetPastPresentationTimingGOOGLE) vkGetDeviceProcAddr(
+                device, "vkGetPastPresentationTimingGOOGLE");
+        getRefreshCycleDuration = (PFN_vkGetRefreshCycleDurationGOOGLE) vkGetDeviceProcAddr(
+                device, "vkGetRefreshCycleDurationGOOGLE");
+    }
+    if (calibratedTimestampsSupported)
+        getCalibratedTimestamps = (PFN_vkGetCalibratedTimestampsEXT) vkGetDeviceProcAddr(
+                device, "vkGetCalibratedTimestampsEXT");
+    if (timelineSupported) {
+        waitTimelineSemaphores = (PFN_vkWaitSemaphoresKHR) vkGetDeviceProcAddr(device, "vkWaitSemaphoresKHR");
+        getTimelineValue = (PFN_vkGetSemaphoreCounterValueKHR) vkGetDeviceProcAddr(
+                device, "vkGetSemaphoreCounterValueKHR");
+    }
+    vkGetDeviceQueue(device, graphicsFamily, 0, &queue);
+    vkGetDeviceQueue(device, graphicsFamily, queuePriorities.size() - 1, &warpQueue);
     vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool);
+
+    computeQueue = queue;
+    transferQueue = queue;
+    if (computeFamily != graphicsFamily)
+        vkGetDeviceQueue(device, computeFamily, 0, &computeQueue);
+    if (transferFamily != graphicsFamily)
+        vkGetDeviceQueue(device, transferFamily, 0, &transferQueue);
+
+    poolInfo.queueFamilyIndex = computeFamily;
+    vkCreateCommandPool(device, &poolInfo, nullptr, &computePool);
+    poolInfo.queueFamilyIndex = transferFamily;
+    vkCreateCommandPool(device, &poolInfo, nullptr, &transferPool);
+
+    // Created with the device, since the structure bake submits long before the frame objects exist
+    sceneTimeline = createTimeline();
+    warpTimeline = createTimeline();
+    computeTimeline = createTimeline();
+    transferTimeline = createTimeline();
+    return true;
 }
 
 VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags flags) {
@@ -215,6 +990,76 @@ VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags f
     return imageView;
 }
 
+// Settings that change how the device is used are read on every setup, so editing viewer.txt takes effect on resume
+void loadSettings() {
+    qualitySetting = -1;
+    targetRate = 0;
+    recordLatency = false;
+
+    if (!app->activity->externalDataPath)
+        return;
+
+    std::string path(app->activity->externalDataPath);
+    std::ifstream file(path + "/viewer.txt");
+    std::string name;
+    float value;
+
+    while (file >> name >> value) {
+        if (name == "quality")
+            qualitySetting = (int32_t) glm::max(value, 0.0f);
+        else if (name == "rate")
+            targetRate = (uint32_t) glm::max(value, 0.0f);
+        else if (name == "latency")
+            recordLatency = value != 0.0f;
+    }
+
+    if (recordLatency && !latencyLog.is_open())
+        latencyLog.open(path + "/latency.log");
+    else if (!recordLatency && latencyLog.is_open())
+        latencyLog.close();
+}
+
+void chooseQuality() {
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+    qualityTier = 0;
+    for (uint32_t index = 0; index < memoryProperties.memoryTypeCount; index++)
+        if (memoryProperties.memoryTypes[index].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)
+            qualityTier = 1;
+
+    if (qualitySetting >= 0)
+        qualityTier = std::min((uint32_t) qualitySetting, (uint32_t) tierSamples.size() - 1);
+
+    // Depth is also sampled by the warp and occlusion passes, so the count has to work for textures too
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+    VkSampleCountFlags supportedCounts = deviceProperties.limits.framebufferColorSampleCounts &
+            deviceProperties.limits.framebufferDepthSampleCounts &
+            deviceProperties.limits.sampledImageDepthSampleCounts;
+
+    // Shaders read the attachments as multisampled images, so a single sample is never picked and 4x always works
+    sampleCount = VK_SAMPLE_COUNT_4_BIT;
+    for (uint32_t samples = VK_SAMPLE_COUNT_2_BIT; samples <= tierSamples[qualityTier]; samples <<= 1)
+        if (supportedCounts & samples)
+            sampleCount = (VkSampleCountFlagBits) samples;
+
+    depthFormat = VK_FORMAT_D32_SFLOAT;
+    for (auto format : tierDepthFormats[qualityTier]) {
+        VkFormatProperties formatProperties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &formatProperties);
+
+        VkFormatFeatureFlags features = VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT |
+                VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+        if ((formatProperties.optimalTilingFeatures & features) == features) {
+            depthFormat = format;
+            break;
+        }
+    }
+
+    LOG("Quality tier %u with %ux multisampling\n", qualityTier, (uint32_t) sampleCount);
+}
+
 //TODO: implement better orientation correction
 void createSwapchain() {
     VkSurfaceCapabilitiesKHR capabilities;
@@ -230,7 +1075,7 @@ void createSwapchain() {
     swapchainInfo.minImageCount = capabilities.minImageCount;
     swapchainInfo.imageFormat = VK_FORMAT_R8G8B8A8_UNORM;
     swapchainInfo.imageColorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
-    swapchainInfo.presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+    swapchainInfo.presentMode = VK_PRESENT_MODE_FIFO_KHR;
     swapchainInfo.clipped = VK_TRUE;
     swapchainInfo.imageExtent = swapchainExtent;
     swapchainInfo.imageArrayLayers = 1;
@@ -249,79 +1094,113 @@ void createSwapchain() {
     for (size_t i = 0; i < imageCount; i++)
         swapchainViews[i] = createImageView(swapchainImages[i], VK_FORMAT_R8G8B8A8_UNORM,
                                             VK_IMAGE_ASPECT_COLOR_BIT);
+
+    // Start from two refresh cycles until presentation feedback comes in
+    VkRefreshCycleDurationGOOGLE refreshCycle{16666666};
+    if (displayTimingSupported)
+        getRefreshCycleDuration(device, swapchain, &refreshCycle);
+
+    presentLatency = 2.0f * refreshCycle.refreshDuration * 1e-9f;
+    presentFrames.clear();
+    resetPacer(pacer, refreshCycle.refreshDuration, targetRate);
+
+    // Leave headroom in every refresh for the warp pass that shares the GPU
+    sceneTimeBudget = 0.8f * refreshCycle.refreshDuration * 1e-6f;
+    renderScale = 1.0f;
+    sceneTime = 0.0f;
+    ssaoTime = 0.0f;
+    scaleCooldown = 0;
+
+    float scale = multiResolution ? foveaExtent + (1.0f - foveaExtent) * peripheryDensity : 1.0f;
+    eyeExtent.width = 2 * (uint32_t) glm::ceil(swapchainExtent.width / 2 * scale);
+    eyeExtent.height = (uint32_t) glm::ceil(swapchainExtent.height * scale);
+}
+
+// Position of an eye NDC coordinate inside the packed eye image, from 0 to 1
+float packFoveated(float ndc) {
+    if (!multiResolution)
+        return ndc * 0.5f + 0.5f;
+
+    float scale = foveaExtent + (1.0f - foveaExtent) * peripheryDensity;
+    float distance = glm::abs(ndc);
+    float packed = glm::min(distance, foveaExtent) + glm::max(distance - foveaExtent, 0.0f) * peripheryDensity;
+    return glm::sign(ndc) * packed / scale * 0.5f + 0.5f;
+}
+
+// One viewport per density region, each keeps the eye projection but maps its NDC range into a smaller area
+void foveatedRegions(uint32_t eye, float scale, std::vector<VkViewport> &viewports,
+                     std::vector<VkRect2D> &scissors) {
+    std::vector<float> bounds{-1.0f, 1.0f};
+    if (multiResolution)
+        bounds = {-1.0f, -foveaExtent, foveaExtent, 1.0f};
+
+    uint32_t offset = eyeExtent.width / 2;
+    float width = offset * scale, height = eyeExtent.height * scale;
+
+    for (size_t row = 0; row + 1 < bounds.size(); row++) {
+        for (size_t column = 0; column + 1 < bounds.size(); column++) {
+            float left = width * packFoveated(bounds[column]), right = width * packFoveated(bounds[column + 1]);
+            float top = height * packFoveated(bounds[row]), bottom = height * packFoveated(bounds[row + 1]);
+            float horizontal = (right - left) / (bounds[column + 1] - bounds[column]);
+            float vertical = (bottom - top) / (bounds[row + 1] - bounds[row]);
+
+            VkViewport viewport{};
+            viewport.x = eye * offset + left - (bounds[column] + 1.0f) * horizontal;
+            viewport.y = top - (bounds[row] + 1.0f) * vertical;
+            viewport.width = 2.0f * horizontal;
+            viewport.height = 2.0f * vertical;
+            viewport.minDepth = 0.0f;
+            viewport.maxDepth = 1.0f;
+
+            VkRect2D scissor{};
+            scissor.offset = {(int32_t) (eye * offset + glm::round(left)), (int32_t) glm::round(top)};
+            scissor.extent = {(uint32_t) (glm::round(right) - glm::round(left)),
+                              (uint32_t) (glm::round(bottom) - glm::round(top))};
+
+            viewports.push_back(viewport);
+            scissors.push_back(scissor);
+        }
+    }
 }
 
+// Opaque geometry, translucent accumulation against its depth, then the composite that resolves to the eye image
 void createRenderPass() {
-    VkAttachmentDescription colorAttachment{};
-    colorAttachment.format = VK_FORMAT_R8G8B8A8_UNORM;
-    colorAttachment.samples = VK_SAMPLE_COUNT_2_BIT;
-    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-    colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-    VkAttachmentDescription depthAttachment{};
-    depthAttachment.format = VK_FORMAT_D32_SFLOAT;
-    depthAttachment.samples = VK_SAMPLE_COUNT_2_BIT;
-    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-    VkAttachmentDescription resolveAttachment{};
-    resolveAttachment.format = VK_FORMAT_R8G8B8A8_UNORM;
-    resolveAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-    resolveAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    resolveAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-    resolveAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    resolveAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    resolveAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    resolveAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-    std::vector<VkAttachmentDescription> attachments{
-            colorAttachment, depthAttachment, resolveAttachment};
-
-    VkAttachmentReference colorReference{};
-    colorReference.attachment = 0;
-    colorReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-    VkAttachmentReference depthReference{};
-    depthReference.attachment = 1;
-    depthReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-    VkAttachmentReference resolveReference{};
-    resolveReference.attachment = 2;
-    resolveReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-    VkSubpassDescription subpass{};
-    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-    subpass.colorAttachmentCount = 1;
-    subpass.pColorAttachments = &colorReference;
-    subpass.pDepthStencilAttachment = &depthReference;
-    subpass.pResolveAttachments = &resolveReference;
-
-    VkSubpassDependency dependency{};
-    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-    dependency.dstSubpass = 0;
-    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.srcAccessMask = 0;
-    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
-    VkRenderPassCreateInfo renderPassInfo{};
-    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    renderPassInfo.attachmentCount = attachments.size();
-    renderPassInfo.pAttachments = attachments.data();
-    renderPassInfo.subpassCount = 1;
-    renderPassInfo.pSubpasses = &subpass;
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &dependency;
-
-    vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass);
+    sceneGraph.attachments = {
+            {VK_FORMAT_R8G8B8A8_UNORM, sampleCount, VK_IMAGE_LAYOUT_UNDEFINED, 0, true, false, false},
+            {depthFormat, sampleCount, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, true, false, true},
+            {VK_FORMAT_R8G8B8A8_UNORM, VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, false, false, true},
+            {VK_FORMAT_R16G16B16A16_SFLOAT, sampleCount, VK_IMAGE_LAYOUT_UNDEFINED, 0, true, false, false},
+            {VK_FORMAT_R8_UNORM, sampleCount, VK_IMAGE_LAYOUT_UNDEFINED, 0, true, false, false}};
+
+    sceneGraph.passes = {
+            {{colorAttachment}, {}, {}, depthAttachment, true, false},
+            {{accumulationAttachment, revealageAttachment}, {}, {}, depthAttachment, false, fragmentListsEnabled},
+            {{colorAttachment}, {resolveAttachment}, {accumulationAttachment, revealageAttachment},
+             VK_ATTACHMENT_UNUSED, false, fragmentListsEnabled}};
+
+    sceneGraph.densityMap = VK_ATTACHMENT_UNUSED;
+    if (densityMapSupported) {
+        sceneGraph.densityMap = sceneGraph.attachments.size();
+        sceneGraph.attachments.push_back({VK_FORMAT_R8G8_UNORM, VK_SAMPLE_COUNT_1_BIT,
+                                          VK_IMAGE_LAYOUT_FRAGMENT_DENSITY_MAP_OPTIMAL_EXT, 0, false, true, false});
+    }
+
+    CompiledGraph compiled;
+    compileRenderGraph(sceneGraph, compiled);
+    vkCreateRenderPass(device, &compiled.renderPassInfo, nullptr, &renderPass);
+}
+
+void createWarpRenderPass() {
+    warpGraph.attachments = {
+            {VK_FORMAT_R8G8B8A8_UNORM, VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, 0, false, false, true}};
+    warpGraph.passes = {{{0}, {}, {}, VK_ATTACHMENT_UNUSED, false, false}};
+    warpGraph.densityMap = VK_ATTACHMENT_UNUSED;
+
+    CompiledGraph compiled;
+    compileRenderGraph(warpGraph, compiled);
+    vkCreateRenderPass(device, &compiled.renderPassInfo, nullptr, &warpRenderPass);
 }
 
 VkShaderModule readShader(const char *path) {
@@ -347,64 +1226,56 @@ void createPipeline() {
     vertexShader = readShader("shaders/shader.vert.spv");
     fragmentShader = readShader("shaders/shader.frag.spv");
 
-    VkSpecializationMapEntry specializationMapEntry{0, 0, sizeof(float)};
-
-    VkSpecializationInfo specializationInfo{};
-    specializationInfo.dataSize = sizeof(float);
-    specializationInfo.mapEntryCount = 1;
-    specializationInfo.pMapEntries = &specializationMapEntry;
-
-    float leftEyeConstant = -1.0f, rightEyeConstant = 1.0f;
-
-    VkSpecializationInfo leftSpecializationInfo = specializationInfo;
-    leftSpecializationInfo.pData = &leftEyeConstant;
-
-    VkSpecializationInfo rightSpecializationInfo = specializationInfo;
-    rightSpecializationInfo.pData = &rightEyeConstant;
-
     VkPipelineShaderStageCreateInfo vertexInfo{};
     vertexInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     vertexInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
     vertexInfo.module = vertexShader;
     vertexInfo.pName = "main";
 
-    VkPipelineShaderStageCreateInfo leftVertexInfo = vertexInfo;
-    leftVertexInfo.pSpecializationInfo = &leftSpecializationInfo;
-
-    VkPipelineShaderStageCreateInfo rightVertexInfo = vertexInfo;
-    rightVertexInfo.pSpecializationInfo = &rightSpecializationInfo;
-
     VkPipelineShaderStageCreateInfo fragmentInfo{};
     fragmentInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     fragmentInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
     fragmentInfo.module = fragmentShader;
     fragmentInfo.pName = "main";
 
-    std::vector<VkPipelineShaderStageCreateInfo> leftShaderStages{leftVertexInfo, fragmentInfo};
-    std::vector<VkPipelineShaderStageCreateInfo> rightShaderStages{rightVertexInfo, fragmentInfo};
+    std::vector<VkPipelineShaderStageCreateInfo> shaderStages{vertexInfo, fragmentInfo};
 
-    VkVertexInputBindingDescription bindingDescription{};
-    bindingDescription.binding = 0;
-    bindingDescription.stride = sizeof(Vertex);
-    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    std::vector<VkVertexInputBindingDescription> bindingDescriptions;
+    bindingDescriptions.resize(3);
 
-    std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
-    attributeDescriptions.resize(2);
+    bindingDescriptions[0].binding = 0;
+    bindingDescriptions[0].stride = assemblyLayout.stride;
+    bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    bindingDescriptions[1].binding = 1;
+    bindingDescriptions[1].stride = sizeof(glm::mat4);
+    bindingDescriptions[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+    bindingDescriptions[2].binding = 2;
+    bindingDescriptions[2].stride = sizeof(uint8_t);
+    bindingDescriptions[2].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
-    attributeDescriptions[0].binding = 0;
-    attributeDescriptions[0].location = 0;
-    attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attributeDescriptions[0].offset = offsetof(Vertex, pos);
+    std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
+    vertexAttributes(assemblyLayout, 0, attributeDescriptions);
+    size_t layoutAttributes = attributeDescriptions.size();
+    attributeDescriptions.resize(layoutAttributes + 5);
+
+    for (uint32_t column = 0; column < 4; column++) {
+        attributeDescriptions[layoutAttributes + column].binding = 1;
+        attributeDescriptions[layoutAttributes + column].location = 2 + column;
+        attributeDescriptions[layoutAttributes + column].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+        attributeDescriptions[layoutAttributes + column].offset = sizeof(glm::vec4) * column;
+    }
 
-    attributeDescriptions[1].binding = 0;
-    attributeDescriptions[1].location = 1;
-    attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attributeDescriptions[1].offset = offsetof(Vertex, col);
+    attributeDescriptions[layoutAttributes + 4].binding = 2;
+    attributeDescriptions[layoutAttributes + 4].location = 6;
+    attributeDescriptions[layoutAttributes + 4].format = VK_FORMAT_R8_UNORM;
+    attributeDescriptions[layoutAttributes + 4].offset = 0;
 
     VkPipelineVertexInputStateCreateInfo inputInfo{};
     inputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    inputInfo.vertexBindingDescriptionCount = 1;
-    inputInfo.pVertexBindingDescriptions = &bindingDescription;
+    inputInfo.vertexBindingDescriptionCount = bindingDescriptions.size();
+    inputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
     inputInfo.vertexAttributeDescriptionCount = attributeDescriptions.size();
     inputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
 
@@ -413,44 +1284,18 @@ void createPipeline() {
     assemblyInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
     assemblyInfo.primitiveRestartEnable = VK_FALSE;
 
-    VkViewport viewport{};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = swapchainExtent.width;
-    viewport.height = swapchainExtent.height;
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-
-    VkViewport leftViewport = viewport;
-    leftViewport.width /= 2;
-
-    VkViewport rightViewport = viewport;
-    rightViewport.width /= 2;
-    rightViewport.x += leftViewport.width;
-
-    VkRect2D scissor{};
-    scissor.offset = {0, 0};
-    scissor.extent = swapchainExtent;
-
-    VkRect2D leftScissor = scissor;
-    leftScissor.extent.width /= 2;
-
-    VkRect2D rightScissor = scissor;
-    rightScissor.extent.width /= 2;
-    rightScissor.offset.x = leftScissor.extent.width;
-
+    // Viewports and scissors come from foveatedRegions when the command buffers are recorded
     VkPipelineViewportStateCreateInfo viewportInfo{};
     viewportInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
     viewportInfo.viewportCount = 1;
     viewportInfo.scissorCount = 1;
 
-    VkPipelineViewportStateCreateInfo leftViewportInfo = viewportInfo;
-    leftViewportInfo.pViewports = &leftViewport;
-    leftViewportInfo.pScissors = &leftScissor;
+    std::vector<VkDynamicState> dynamicStates{VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
 
-    VkPipelineViewportStateCreateInfo rightViewportInfo = viewportInfo;
-    rightViewportInfo.pViewports = &rightViewport;
-    rightViewportInfo.pScissors = &rightScissor;
+    VkPipelineDynamicStateCreateInfo dynamicInfo{};
+    dynamicInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicInfo.dynamicStateCount = dynamicStates.size();
+    dynamicInfo.pDynamicStates = dynamicStates.data();
 
     VkPipelineRasterizationStateCreateInfo rasterizerInfo{};
     rasterizerInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
@@ -468,7 +1313,7 @@ void createPipeline() {
     VkPipelineMultisampleStateCreateInfo multisamplingInfo{};
     multisamplingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
     multisamplingInfo.sampleShadingEnable = VK_FALSE;
-    multisamplingInfo.rasterizationSamples = VK_SAMPLE_COUNT_2_BIT;
+    multisamplingInfo.rasterizationSamples = sampleCount;
     multisamplingInfo.minSampleShading = 1.0f;
     multisamplingInfo.pSampleMask = nullptr;
     multisamplingInfo.alphaToCoverageEnable = VK_FALSE;
@@ -517,10 +1362,46 @@ void createPipeline() {
     transformLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
     transformLayoutBinding.pImmutableSamplers = nullptr;
 
+    VkDescriptorSetLayoutBinding positionLayoutBinding{};
+    positionLayoutBinding.binding = 1;
+    positionLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    positionLayoutBinding.descriptorCount = 1;
+    positionLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    positionLayoutBinding.pImmutableSamplers = nullptr;
+
+    VkDescriptorSetLayoutBinding accumulationLayoutBinding{};
+    accumulationLayoutBinding.binding = 2;
+    accumulationLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+    accumulationLayoutBinding.descriptorCount = 1;
+    accumulationLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    accumulationLayoutBinding.pImmutableSamplers = nullptr;
+
+    VkDescriptorSetLayoutBinding revealageLayoutBinding = accumulationLayoutBinding;
+    revealageLayoutBinding.binding = 3;
+
+    VkDescriptorSetLayoutBinding fragmentHeadLayoutBinding = accumulationLayoutBinding;
+    fragmentHeadLayoutBinding.binding = 4;
+    fragmentHeadLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+
+    VkDescriptorSetLayoutBinding fragmentLayoutBinding = accumulationLayoutBinding;
+    fragmentLayoutBinding.binding = 5;
+    fragmentLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+
+    VkDescriptorSetLayoutBinding paletteLayoutBinding = positionLayoutBinding;
+    paletteLayoutBinding.binding = 6;
+
+    std::vector<VkDescriptorSetLayoutBinding> layoutBindings{transformLayoutBinding,
+                                                             positionLayoutBinding,
+                                                             accumulationLayoutBinding,
+                                                             revealageLayoutBinding,
+                                                             fragmentHeadLayoutBinding,
+                                                             fragmentLayoutBinding,
+                                                             paletteLayoutBinding};
+
     VkDescriptorSetLayoutCreateInfo descriptorInfo{};
     descriptorInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    descriptorInfo.bindingCount = 1;
-    descriptorInfo.pBindings = &transformLayoutBinding;
+    descriptorInfo.bindingCount = layoutBindings.size();
+    descriptorInfo.pBindings = layoutBindings.data();
 
     vkCreateDescriptorSetLayout(device, &descriptorInfo, nullptr, &descriptorSetLayout);
 
@@ -528,103 +1409,316 @@ void createPipeline() {
     layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
     layoutInfo.setLayoutCount = 1;
     layoutInfo.pSetLayouts = &descriptorSetLayout;
-    layoutInfo.pushConstantRangeCount = 0;
-    layoutInfo.pPushConstantRanges = nullptr;
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(DrawConstants);
+
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &pushConstantRange;
 
     vkCreatePipelineLayout(device, &layoutInfo, nullptr, &pipelineLayout);
 
     VkGraphicsPipelineCreateInfo pipelineInfo{};
     pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    pipelineInfo.stageCount = 2;
+    pipelineInfo.stageCount = shaderStages.size();
+    pipelineInfo.pStages = shaderStages.data();
     pipelineInfo.pVertexInputState = &inputInfo;
     pipelineInfo.pInputAssemblyState = &assemblyInfo;
     pipelineInfo.pRasterizationState = &rasterizerInfo;
     pipelineInfo.pMultisampleState = &multisamplingInfo;
     pipelineInfo.pDepthStencilState = &depthStencil;
     pipelineInfo.pColorBlendState = &blendInfo;
-    pipelineInfo.pDynamicState = nullptr;
+    pipelineInfo.pViewportState = &viewportInfo;
+    pipelineInfo.pDynamicState = &dynamicInfo;
     pipelineInfo.layout = pipelineLayout;
     pipelineInfo.renderPass = renderPass;
     pipelineInfo.subpass = 0;
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
     pipelineInfo.basePipelineIndex = -1;
 
-    VkGraphicsPipelineCreateInfo leftPipelineInfo = pipelineInfo;
-    leftPipelineInfo.pStages = leftShaderStages.data();
-    leftPipelineInfo.pViewportState = &leftViewportInfo;
-
-    VkGraphicsPipelineCreateInfo rightPipelineInfo = pipelineInfo;
-    rightPipelineInfo.pStages = rightShaderStages.data();
-    rightPipelineInfo.pViewportState = &rightViewportInfo;
-
-    vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &leftPipelineInfo, nullptr,
-                              &leftGraphicsPipeline);
-    vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &rightPipelineInfo, nullptr,
-                              &rightGraphicsPipeline);
+    // Both eyes share one pipeline, the eye is pushed per draw and viewports are dynamic
+    vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline);
+
+    // Translucent chunks are still depth tested against the opaque scene but never write depth
+    transparentShader = readShader(fragmentListsEnabled ? "shaders/fragmentlist.frag.spv"
+                                                        : "shaders/transparent.frag.spv");
+    std::vector<VkPipelineShaderStageCreateInfo> transparentShaderStages = shaderStages;
+    transparentShaderStages[1].module = transparentShader;
+
+    VkPipelineDepthStencilStateCreateInfo transparentDepthStencil = depthStencil;
+    transparentDepthStencil.depthWriteEnable = VK_FALSE;
+
+    // Accumulation adds premultiplied weighted colour, revealage multiplies the transmittance down
+    std::vector<VkPipelineColorBlendAttachmentState> transparentBlendAttachments(2, blendAttachment);
+    transparentBlendAttachments[0].srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+    transparentBlendAttachments[0].dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+    transparentBlendAttachments[0].dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    transparentBlendAttachments[1].colorWriteMask = VK_COLOR_COMPONENT_R_BIT;
+    transparentBlendAttachments[1].srcColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+    transparentBlendAttachments[1].dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_COLOR;
+
+    VkPipelineColorBlendStateCreateInfo transparentBlendInfo = blendInfo;
+    transparentBlendInfo.attachmentCount = transparentBlendAttachments.size();
+    transparentBlendInfo.pAttachments = transparentBlendAttachments.data();
+
+    VkGraphicsPipelineCreateInfo transparentPipelineInfo = pipelineInfo;
+    transparentPipelineInfo.pStages = transparentShaderStages.data();
+    transparentPipelineInfo.pDepthStencilState = &transparentDepthStencil;
+    transparentPipelineInfo.pColorBlendState = &transparentBlendInfo;
+    transparentPipelineInfo.subpass = 1;
+
+    vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &transparentPipelineInfo, nullptr,
+                              &transparentPipeline);
+
+    compositeVertexShader = readShader("shaders/composite.vert.spv");
+    compositeFragmentShader = readShader("shaders/composite.frag.spv");
+
+    std::vector<VkSpecializationMapEntry> compositeEntries{{0, 0, sizeof(uint32_t)},
+                                                           {1, sizeof(uint32_t), sizeof(uint32_t)}};
+    std::vector<uint32_t> compositeConstants{fragmentListsEnabled,
+                                             (uint32_t) multisamplingInfo.rasterizationSamples};
+
+    VkSpecializationInfo compositeSpecializationInfo{};
+    compositeSpecializationInfo.mapEntryCount = compositeEntries.size();
+    compositeSpecializationInfo.pMapEntries = compositeEntries.data();
+    compositeSpecializationInfo.dataSize = sizeof(uint32_t) * compositeConstants.size();
+    compositeSpecializationInfo.pData = compositeConstants.data();
+
+    VkPipelineShaderStageCreateInfo compositeVertexInfo = vertexInfo;
+    compositeVertexInfo.module = compositeVertexShader;
+
+    VkPipelineShaderStageCreateInfo compositeFragmentInfo = fragmentInfo;
+    compositeFragmentInfo.module = compositeFragmentShader;
+    compositeFragmentInfo.pSpecializationInfo = &compositeSpecializationInfo;
+
+    std::vector<VkPipelineShaderStageCreateInfo> compositeShaderStages{compositeVertexInfo,
+                                                                       compositeFragmentInfo};
+
+    VkPipelineVertexInputStateCreateInfo compositeInputInfo{};
+    compositeInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+    VkPipelineRasterizationStateCreateInfo compositeRasterizerInfo = rasterizerInfo;
+    compositeRasterizerInfo.cullMode = VK_CULL_MODE_NONE;
+
+    VkGraphicsPipelineCreateInfo compositePipelineInfo = pipelineInfo;
+    compositePipelineInfo.pStages = compositeShaderStages.data();
+    compositePipelineInfo.pVertexInputState = &compositeInputInfo;
+    compositePipelineInfo.pRasterizationState = &compositeRasterizerInfo;
+    compositePipelineInfo.pDepthStencilState = nullptr;
+    compositePipelineInfo.subpass = 2;
+
+    vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &compositePipelineInfo, nullptr,
+                              &compositePipeline);
 }
 
-uint32_t chooseMemoryType(uint32_t filter, VkMemoryPropertyFlags flags) {
-    VkPhysicalDeviceMemoryProperties memoryProperties;
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
-
-    for (uint32_t index = 0; index < memoryProperties.memoryTypeCount; index++)
-        if ((filter & (1 << index)) &&
-                (memoryProperties.memoryTypes[index].propertyFlags & flags) == flags)
-            return index;
+void createWarpPipeline() {
+    warpVertexShader = readShader("shaders/warp.vert.spv");
+    warpFragmentShader = readShader("shaders/warp.frag.spv");
 
-    return UINT_MAX;
-}
+    VkPipelineShaderStageCreateInfo vertexInfo{};
+    vertexInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    vertexInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+    vertexInfo.module = warpVertexShader;
+    vertexInfo.pName = "main";
 
-void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
-                  VkBuffer &buffer, VkDeviceMemory &bufferMemory) {
-    VkMemoryRequirements memoryRequirements;
+    VkPipelineShaderStageCreateInfo fragmentInfo{};
+    fragmentInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    fragmentInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    fragmentInfo.module = warpFragmentShader;
+    fragmentInfo.pName = "main";
 
-    VkBufferCreateInfo bufferInfo = {};
-    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    bufferInfo.usage = usage;
-    bufferInfo.size = size;
+    std::vector<VkPipelineShaderStageCreateInfo> shaderStages{vertexInfo, fragmentInfo};
 
-    vkCreateBuffer(device, &bufferInfo, NULL, &buffer);
-    vkGetBufferMemoryRequirements(device, buffer, &memoryRequirements);
+    VkVertexInputBindingDescription bindingDescription{};
+    bindingDescription.binding = 0;
+    bindingDescription.stride = sizeof(DistortionVertex);
+    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
-    VkMemoryAllocateInfo allocateInfo = {};
-    allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocateInfo.allocationSize = memoryRequirements.size;
-    allocateInfo.memoryTypeIndex = chooseMemoryType(memoryRequirements.memoryTypeBits, properties);
+    std::vector<VkVertexInputAttributeDescription> attributeDescriptions(4);
+    for (uint32_t location = 0; location < attributeDescriptions.size(); location++) {
+        attributeDescriptions[location].binding = 0;
+        attributeDescriptions[location].location = location;
+        attributeDescriptions[location].format = VK_FORMAT_R32G32_SFLOAT;
+        attributeDescriptions[location].offset = location * sizeof(glm::vec2);
+    }
 
-    vkAllocateMemory(device, &allocateInfo, NULL, &bufferMemory);
-    vkBindBufferMemory(device, buffer, bufferMemory, 0);
-}
+    VkPipelineVertexInputStateCreateInfo inputInfo{};
+    inputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    inputInfo.vertexBindingDescriptionCount = 1;
+    inputInfo.pVertexBindingDescriptions = &bindingDescription;
+    inputInfo.vertexAttributeDescriptionCount = attributeDescriptions.size();
+    inputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
 
-void createImage(uint32_t width, uint32_t height, VkFormat format, VkSampleCountFlagBits samples,
-                 VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties,
-                 VkImage &image, VkDeviceMemory &imageMemory) {
-    VkImageCreateInfo imageInfo{};
-    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-    imageInfo.imageType = VK_IMAGE_TYPE_2D;
-    imageInfo.extent.width = width;
-    imageInfo.extent.height = height;
-    imageInfo.extent.depth = 1;
-    imageInfo.mipLevels = 1;
-    imageInfo.arrayLayers = 1;
-    imageInfo.format = format;
-    imageInfo.tiling = tiling;
-    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    imageInfo.usage = usage;
-    imageInfo.samples = samples;
-    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    VkPipelineInputAssemblyStateCreateInfo assemblyInfo{};
+    assemblyInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    assemblyInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    assemblyInfo.primitiveRestartEnable = VK_FALSE;
 
-    vkCreateImage(device, &imageInfo, nullptr, &image);
+    VkViewport viewport{};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = swapchainExtent.width;
+    viewport.height = swapchainExtent.height;
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
 
-    VkMemoryRequirements memRequirements;
-    vkGetImageMemoryRequirements(device, image, &memRequirements);
+    VkRect2D scissor{};
+    scissor.offset = {0, 0};
+    scissor.extent = swapchainExtent;
 
-    VkMemoryAllocateInfo allocInfo{};
+    VkPipelineViewportStateCreateInfo viewportInfo{};
+    viewportInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewportInfo.viewportCount = 1;
+    viewportInfo.pViewports = &viewport;
+    viewportInfo.scissorCount = 1;
+    viewportInfo.pScissors = &scissor;
+
+    VkPipelineRasterizationStateCreateInfo rasterizerInfo{};
+    rasterizerInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizerInfo.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterizerInfo.lineWidth = 1.0f;
+    rasterizerInfo.cullMode = VK_CULL_MODE_NONE;
+    rasterizerInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+    VkPipelineMultisampleStateCreateInfo multisamplingInfo{};
+    multisamplingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisamplingInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    multisamplingInfo.minSampleShading = 1.0f;
+
+    VkPipelineColorBlendAttachmentState blendAttachment{};
+    blendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT |
+            VK_COLOR_COMPONENT_G_BIT |
+            VK_COLOR_COMPONENT_B_BIT |
+            VK_COLOR_COMPONENT_A_BIT;
+    blendAttachment.blendEnable = VK_FALSE;
+
+    VkPipelineColorBlendStateCreateInfo blendInfo{};
+    blendInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    blendInfo.logicOpEnable = VK_FALSE;
+    blendInfo.attachmentCount = 1;
+    blendInfo.pAttachments = &blendAttachment;
+
+    VkDescriptorSetLayoutBinding warpLayoutBinding{};
+    warpLayoutBinding.binding = 0;
+    warpLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    warpLayoutBinding.descriptorCount = 1;
+    warpLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    VkDescriptorSetLayoutBinding colorLayoutBinding{};
+    colorLayoutBinding.binding = 1;
+    colorLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    colorLayoutBinding.descriptorCount = 1;
+    colorLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    VkDescriptorSetLayoutBinding depthLayoutBinding = colorLayoutBinding;
+    depthLayoutBinding.binding = 2;
+
+    VkDescriptorSetLayoutBinding occlusionLayoutBinding = colorLayoutBinding;
+    occlusionLayoutBinding.binding = 3;
+
+    std::vector<VkDescriptorSetLayoutBinding> layoutBindings{warpLayoutBinding, colorLayoutBinding,
+                                                             depthLayoutBinding, occlusionLayoutBinding};
+
+    VkDescriptorSetLayoutCreateInfo descriptorInfo{};
+    descriptorInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descriptorInfo.bindingCount = layoutBindings.size();
+    descriptorInfo.pBindings = layoutBindings.data();
+
+    vkCreateDescriptorSetLayout(device, &descriptorInfo, nullptr, &warpDescriptorSetLayout);
+
+    VkPipelineLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &warpDescriptorSetLayout;
+
+    vkCreatePipelineLayout(device, &layoutInfo, nullptr, &warpPipelineLayout);
+
+    VkGraphicsPipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipelineInfo.stageCount = shaderStages.size();
+    pipelineInfo.pStages = shaderStages.data();
+    pipelineInfo.pVertexInputState = &inputInfo;
+    pipelineInfo.pInputAssemblyState = &assemblyInfo;
+    pipelineInfo.pViewportState = &viewportInfo;
+    pipelineInfo.pRasterizationState = &rasterizerInfo;
+    pipelineInfo.pMultisampleState = &multisamplingInfo;
+    pipelineInfo.pColorBlendState = &blendInfo;
+    pipelineInfo.layout = warpPipelineLayout;
+    pipelineInfo.renderPass = warpRenderPass;
+    pipelineInfo.subpass = 0;
+    pipelineInfo.basePipelineIndex = -1;
+
+    vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &warpPipeline);
+}
+
+uint32_t chooseMemoryType(uint32_t filter, VkMemoryPropertyFlags flags) {
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+    for (uint32_t index = 0; index < memoryProperties.memoryTypeCount; index++)
+        if ((filter & (1 << index)) &&
+                (memoryProperties.memoryTypes[index].propertyFlags & flags) == flags)
+            return index;
+
+    return UINT_MAX;
+}
+
+void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+                  VkBuffer &buffer, VkDeviceMemory &bufferMemory) {
+    VkMemoryRequirements memoryRequirements;
+
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    bufferInfo.usage = usage;
+    bufferInfo.size = size;
+
+    vkCreateBuffer(device, &bufferInfo, NULL, &buffer);
+    vkGetBufferMemoryRequirements(device, buffer, &memoryRequirements);
+
+    VkMemoryAllocateInfo allocateInfo = {};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocateInfo.allocationSize = memoryRequirements.size;
+    allocateInfo.memoryTypeIndex = chooseMemoryType(memoryRequirements.memoryTypeBits, properties);
+
+    vkAllocateMemory(device, &allocateInfo, NULL, &bufferMemory);
+    vkBindBufferMemory(device, buffer, bufferMemory, 0);
+}
+
+void createImage(uint32_t width, uint32_t height, VkFormat format, VkSampleCountFlagBits samples,
+                 VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties,
+                 VkImage &image, VkDeviceMemory &imageMemory) {
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent.width = width;
+    imageInfo.extent.height = height;
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.format = format;
+    imageInfo.tiling = tiling;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage = usage;
+    imageInfo.samples = samples;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    vkCreateImage(device, &imageInfo, nullptr, &image);
+
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(device, image, &memRequirements);
+
+    VkMemoryAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
     allocInfo.allocationSize = memRequirements.size;
     allocInfo.memoryTypeIndex = chooseMemoryType(memRequirements.memoryTypeBits, properties);
 
+    // Lazily allocated memory is only a preference, without it transient attachments get ordinary memory
+    if (allocInfo.memoryTypeIndex == UINT_MAX && (properties & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT))
+        allocInfo.memoryTypeIndex = chooseMemoryType(memRequirements.memoryTypeBits,
+                                                     properties & ~VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+
     vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory);
     vkBindImageMemory(device, image, imageMemory, 0);
 }
@@ -708,6 +1802,10 @@ void transitionImageLayout(VkImage image, uint32_t levels, VkFormat format, VkIm
         barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
                 VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
         stage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    } else if (layout == VK_IMAGE_LAYOUT_GENERAL) {
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        stage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
     }
 
     vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
@@ -735,51 +1833,241 @@ void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t imageWidth, uint
 }
 
 void createColorBuffer() {
-    createImage(swapchainExtent.width, swapchainExtent.height, VK_FORMAT_R8G8B8A8_UNORM,
-                VK_SAMPLE_COUNT_2_BIT, VK_IMAGE_TILING_OPTIMAL,
-                VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, colorImage, colorMemory);
+    createImage(eyeExtent.width, eyeExtent.height, VK_FORMAT_R8G8B8A8_UNORM,
+                sampleCount, VK_IMAGE_TILING_OPTIMAL, attachmentUsage(sceneGraph, colorAttachment),
+                attachmentMemory(sceneGraph, colorAttachment), colorImage, colorMemory);
     colorView = createImageView(colorImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
+
+    createImage(eyeExtent.width, eyeExtent.height, VK_FORMAT_R16G16B16A16_SFLOAT,
+                sampleCount, VK_IMAGE_TILING_OPTIMAL, attachmentUsage(sceneGraph, accumulationAttachment),
+                attachmentMemory(sceneGraph, accumulationAttachment), accumulationImage, accumulationMemory);
+    accumulationView = createImageView(accumulationImage, VK_FORMAT_R16G16B16A16_SFLOAT,
+                                       VK_IMAGE_ASPECT_COLOR_BIT);
+
+    createImage(eyeExtent.width, eyeExtent.height, VK_FORMAT_R8_UNORM,
+                sampleCount, VK_IMAGE_TILING_OPTIMAL, attachmentUsage(sceneGraph, revealageAttachment),
+                attachmentMemory(sceneGraph, revealageAttachment), revealageImage, revealageMemory);
+    revealageView = createImageView(revealageImage, VK_FORMAT_R8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
+
+    // Without fragment lists a single texel and record keep the composite descriptors valid
+    VkExtent2D headExtent = fragmentListsEnabled ? eyeExtent : VkExtent2D{1, 1};
+    createImage(headExtent.width, headExtent.height, VK_FORMAT_R32_UINT, VK_SAMPLE_COUNT_1_BIT,
+                VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, fragmentHeadImage, fragmentHeadMemory);
+    fragmentHeadView = createImageView(fragmentHeadImage, VK_FORMAT_R32_UINT, VK_IMAGE_ASPECT_COLOR_BIT);
+    transitionImageLayout(fragmentHeadImage, 1, VK_FORMAT_R32_UINT, VK_IMAGE_LAYOUT_GENERAL);
+
+    // The fragment count sits in the first record, the rest hold colour, depth and the next index
+    VkDeviceSize fragmentCapacity = (VkDeviceSize) headExtent.width * headExtent.height * fragmentListDepth;
+    createBuffer(sizeof(glm::uvec4) * (fragmentCapacity + 1),
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, fragmentBuffer, fragmentMemory);
+}
+
+// Both eyes side by side, resolved color and multisampled depth are kept for reprojection
+void createEyeImages() {
+    eyeColorImages.resize(eyeImageCount);
+    eyeColorViews.resize(eyeImageCount);
+    eyeColorMemories.resize(eyeImageCount);
+    eyeDepthImages.resize(eyeImageCount);
+    eyeDepthViews.resize(eyeImageCount);
+    eyeDepthMemories.resize(eyeImageCount);
+
+    for (size_t i = 0; i < eyeImageCount; i++) {
+        createImage(eyeExtent.width, eyeExtent.height, VK_FORMAT_R8G8B8A8_UNORM,
+                    VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_TILING_OPTIMAL,
+                    attachmentUsage(sceneGraph, resolveAttachment) | VK_IMAGE_USAGE_SAMPLED_BIT,
+                    attachmentMemory(sceneGraph, resolveAttachment), eyeColorImages[i], eyeColorMemories[i]);
+        eyeColorViews[i] = createImageView(eyeColorImages[i], VK_FORMAT_R8G8B8A8_UNORM,
+                                           VK_IMAGE_ASPECT_COLOR_BIT);
+
+        createImage(eyeExtent.width, eyeExtent.height, depthFormat,
+                    sampleCount, VK_IMAGE_TILING_OPTIMAL,
+                    attachmentUsage(sceneGraph, depthAttachment) | VK_IMAGE_USAGE_SAMPLED_BIT,
+                    attachmentMemory(sceneGraph, depthAttachment), eyeDepthImages[i], eyeDepthMemories[i]);
+        eyeDepthViews[i] = createImageView(eyeDepthImages[i], depthFormat,
+                                           VK_IMAGE_ASPECT_DEPTH_BIT);
+    }
+
+    // Occlusion stays in the general layout, written by the scene queue and sampled by the warp pass
+    ssaoExtent = {(eyeExtent.width + 1) / 2, (eyeExtent.height + 1) / 2};
+    eyeOcclusionImages.resize(eyeImageCount);
+    eyeOcclusionViews.resize(eyeImageCount);
+    eyeOcclusionMemories.resize(eyeImageCount);
+
+    for (size_t i = 0; i < eyeImageCount; i++) {
+        createImage(ssaoExtent.width, ssaoExtent.height, VK_FORMAT_R32_SFLOAT, VK_SAMPLE_COUNT_1_BIT,
+                    VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, eyeOcclusionImages[i], eyeOcclusionMemories[i]);
+        eyeOcclusionViews[i] = createImageView(eyeOcclusionImages[i], VK_FORMAT_R32_SFLOAT,
+                                               VK_IMAGE_ASPECT_COLOR_BIT);
+        transitionImageLayout(eyeOcclusionImages[i], 1, VK_FORMAT_R32_SFLOAT, VK_IMAGE_LAYOUT_GENERAL);
+    }
+
+    VkSamplerCreateInfo samplerInfo{};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.maxLod = 0.0f;
+
+    vkCreateSampler(device, &samplerInfo, nullptr, &eyeSampler);
+}
+
+// Density texels follow the same fovea as the multi-resolution split, red is horizontal and green vertical
+void writeDensityMap(uint8_t *densities, float scale) {
+    uint8_t periphery = (uint8_t) glm::round(peripheryDensity * 255.0f);
+    float eyeWidth = swapchainExtent.width / 2.0f;
+
+    for (uint32_t y = 0; y < densityExtent.height; y++) {
+        for (uint32_t x = 0; x < densityExtent.width; x++) {
+            float pixel = glm::mod((x + 0.5f) * densityTexelSize.width, eyeWidth);
+            float horizontal = pixel / (eyeWidth * scale) * 2.0f - 1.0f;
+            float vertical = (y + 0.5f) * densityTexelSize.height / (swapchainExtent.height * scale) * 2.0f - 1.0f;
+
+            densities[2 * (y * densityExtent.width + x)] = glm::abs(horizontal) > foveaExtent ? periphery : 255;
+            densities[2 * (y * densityExtent.width + x) + 1] = glm::abs(vertical) > foveaExtent ? periphery : 255;
+        }
+    }
+}
+
+void recordDensityBarrier(VkCommandBuffer commandBuffer, VkImage image, bool upload) {
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.image = image;
+    barrier.oldLayout = upload ? VK_IMAGE_LAYOUT_FRAGMENT_DENSITY_MAP_OPTIMAL_EXT :
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = upload ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL :
+            VK_IMAGE_LAYOUT_FRAGMENT_DENSITY_MAP_OPTIMAL_EXT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    barrier.srcAccessMask = upload ? 0 : VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = upload ? VK_ACCESS_TRANSFER_WRITE_BIT : VK_ACCESS_FRAGMENT_DENSITY_MAP_READ_BIT_EXT;
+
+    VkPipelineStageFlags density = VK_PIPELINE_STAGE_FRAGMENT_DENSITY_PROCESS_BIT_EXT;
+    VkPipelineStageFlags transfer = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    vkCmdPipelineBarrier(commandBuffer, upload ? density : transfer, upload ? transfer : density, 0, 0, nullptr,
+                         0, nullptr, 1, &barrier);
+}
+
+void copyDensityMap(VkCommandBuffer commandBuffer, uint32_t eye) {
+    VkBufferImageCopy region{};
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.imageExtent = {densityExtent.width, densityExtent.height, 1};
+
+    recordDensityBarrier(commandBuffer, densityImages[eye], true);
+    vkCmdCopyBufferToImage(commandBuffer, densityStagingBuffers[eye], densityImages[eye],
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    recordDensityBarrier(commandBuffer, densityImages[eye], false);
 }
 
-void createDepthBuffer() {
-    createImage(swapchainExtent.width, swapchainExtent.height, VK_FORMAT_D32_SFLOAT,
-                VK_SAMPLE_COUNT_2_BIT, VK_IMAGE_TILING_OPTIMAL,
-                VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                depthImage, depthMemory);
-    depthView = createImageView(depthImage, VK_FORMAT_D32_SFLOAT, VK_IMAGE_ASPECT_DEPTH_BIT);
+// Every eye image has its own map so it can follow that image's render scale
+void createDensityMaps() {
+    if (!densityMapSupported)
+        return;
+
+    densityExtent.width = (swapchainExtent.width + densityTexelSize.width - 1) / densityTexelSize.width;
+    densityExtent.height = (swapchainExtent.height + densityTexelSize.height - 1) / densityTexelSize.height;
+    VkDeviceSize mapSize = 2 * densityExtent.width * densityExtent.height;
+
+    densityImages.resize(eyeImageCount);
+    densityViews.resize(eyeImageCount);
+    densityMemories.resize(eyeImageCount);
+    densityStagingBuffers.resize(eyeImageCount);
+    densityStagingMemories.resize(eyeImageCount);
+    densityStagingMappings.resize(eyeImageCount);
+
+    for (size_t i = 0; i < eyeImageCount; i++) {
+        createBuffer(mapSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                     densityStagingBuffers[i], densityStagingMemories[i]);
+        vkMapMemory(device, densityStagingMemories[i], 0, mapSize, 0, &densityStagingMappings[i]);
+        writeDensityMap((uint8_t *) densityStagingMappings[i], 1.0f);
+
+        createImage(densityExtent.width, densityExtent.height, VK_FORMAT_R8G8_UNORM, VK_SAMPLE_COUNT_1_BIT,
+                    VK_IMAGE_TILING_OPTIMAL,
+                    VK_IMAGE_USAGE_FRAGMENT_DENSITY_MAP_BIT_EXT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, densityImages[i], densityMemories[i]);
+        densityViews[i] = createImageView(densityImages[i], VK_FORMAT_R8G8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
+
+        transitionImageLayout(densityImages[i], 1, VK_FORMAT_R8G8_UNORM, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+        copyBufferToImage(densityStagingBuffers[i], densityImages[i], densityExtent.width, densityExtent.height);
+
+        VkCommandBuffer commandBuffer = beginSingleTimeCommand();
+        recordDensityBarrier(commandBuffer, densityImages[i], false);
+        endSingleTimeCommand(commandBuffer);
+    }
 }
 
 void createFramebuffers() {
-    framebuffers.resize(imageCount);
-    for (size_t i = 0; i < imageCount; i++) {
-        std::vector<VkImageView> attachments{colorView, depthView, swapchainViews[i]};
+    framebuffers.resize(eyeImageCount);
+    for (size_t i = 0; i < eyeImageCount; i++) {
+        std::vector<VkImageView> attachments{colorView, eyeDepthViews[i], eyeColorViews[i], accumulationView,
+                                             revealageView};
+        if (densityMapSupported)
+            attachments.push_back(densityViews[i]);
+
         VkFramebufferCreateInfo framebufferInfo{};
         framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
         framebufferInfo.renderPass = renderPass;
         framebufferInfo.attachmentCount = attachments.size();
         framebufferInfo.pAttachments = attachments.data();
+        framebufferInfo.width = eyeExtent.width;
+        framebufferInfo.height = eyeExtent.height;
+        framebufferInfo.layers = 1;
+        vkCreateFramebuffer(device, &framebufferInfo, nullptr, &framebuffers[i]);
+    }
+
+    warpFramebuffers.resize(imageCount);
+    for (size_t i = 0; i < imageCount; i++) {
+        VkFramebufferCreateInfo framebufferInfo{};
+        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        framebufferInfo.renderPass = warpRenderPass;
+        framebufferInfo.attachmentCount = 1;
+        framebufferInfo.pAttachments = &swapchainViews[i];
         framebufferInfo.width = swapchainExtent.width;
         framebufferInfo.height = swapchainExtent.height;
         framebufferInfo.layers = 1;
-        vkCreateFramebuffer(device, &framebufferInfo, nullptr, &framebuffers[i]);
+        vkCreateFramebuffer(device, &framebufferInfo, nullptr, &warpFramebuffers[i]);
     }
 }
 
-void createVertexBuffer() {
+// Palette entries are written straight into mapped memory, so chunks streamed later can add colors
+void createPaletteBuffer() {
+    createBuffer(sizeof(glm::vec4) * paletteCapacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 paletteBuffer, paletteMemory);
+    vkMapMemory(device, paletteMemory, 0, sizeof(glm::vec4) * paletteCapacity, 0, (void **) &paletteMapping);
+}
 
-    for (int i = -1; i <= 1; i++) {
-        for (int j = -1; j <= 1; j++) {
-            for (auto vertex : vertexData) {
-                auto data = vertex;
-                data.pos.x += i * 2;
-                data.pos.y += j * 2;
-                vertices.push_back(data);
-            }
-        }
+uint32_t paletteColor(const glm::vec3 &color) {
+    std::lock_guard<std::mutex> lock(paletteMutex);
+    uint32_t index = paletteIndex(palette, color);
+    paletteMapping[index] = palette.colors[index];
+    return index;
+}
+
+void createVertexBuffer() {
+    glm::vec3 minimum(FLT_MAX), maximum(-FLT_MAX);
+    for (auto &vertex : vertexData) {
+        minimum = glm::min(minimum, vertex.pos);
+        maximum = glm::max(maximum, vertex.pos);
     }
 
-    VkDeviceSize bufferSize = sizeof(Vertex) * vertices.size();
+    assemblyCenter = (minimum + maximum) / 2.0f;
+    assemblyRadius = glm::length(maximum - assemblyCenter);
+
+    quantizeVertexLayout(assemblyLayout, minimum, maximum);
+    std::vector<uint8_t> vertices(assemblyLayout.stride * vertexData.size());
+    for (size_t i = 0; i < vertexData.size(); i++)
+        encodeVertex(assemblyLayout, {vertexData[i].pos, glm::vec3(0.0f), paletteColor(vertexData[i].col)},
+                     vertices.data() + assemblyLayout.stride * i);
+
+    VkDeviceSize bufferSize = vertices.size();
 
     VkBuffer stagingBuffer;
     VkDeviceMemory stagingMemory;
@@ -801,13 +2089,7 @@ void createVertexBuffer() {
 }
 
 void createIndexBuffer() {
-    for (int i = 0; i < 9; i++) {
-        for (auto index : indexData) {
-            indices.push_back(index + vertexData.size() * i);
-        }
-    }
-
-    VkDeviceSize bufferSize = sizeof(uint16_t) * indices.size();
+    VkDeviceSize bufferSize = sizeof(uint32_t) * indexData.size();
 
     VkBuffer stagingBuffer;
     VkDeviceMemory stagingMemory;
@@ -817,7 +2099,7 @@ void createIndexBuffer() {
 
     void *data;
     vkMapMemory(device, stagingMemory, 0, bufferSize, 0, &data);
-    memcpy(data, indices.data(), (size_t) bufferSize);
+    memcpy(data, indexData.data(), (size_t) bufferSize);
     vkUnmapMemory(device, stagingMemory);
 
     createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
@@ -828,326 +2110,2755 @@ void createIndexBuffer() {
     vkFreeMemory(device, stagingMemory, nullptr);
 }
 
-void createUniformBuffers() {
-    VkDeviceSize bufferSize = sizeof(Transform);
+void createHostBuffer(const void *contents, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer &buffer,
+                      VkDeviceMemory &bufferMemory) {
+    createBuffer(size, usage, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 buffer, bufferMemory);
 
-    uniformBuffers.resize(imageCount);
-    uniformMemories.resize(imageCount);
+    void *data;
+    vkMapMemory(device, bufferMemory, 0, size, 0, &data);
+    memcpy(data, contents, (size_t) size);
+    vkUnmapMemory(device, bufferMemory);
+}
 
-    for (size_t i = 0; i < imageCount; i++)
-        createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                     uniformBuffers[i], uniformMemories[i]);
+void createDeviceBuffer(const void *source, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer &buffer,
+                        VkDeviceMemory &memory) {
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingMemory;
+    createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 stagingBuffer, stagingMemory);
+
+    void *data;
+    vkMapMemory(device, stagingMemory, 0, size, 0, &data);
+    memcpy(data, source, (size_t) size);
+    vkUnmapMemory(device, stagingMemory);
+
+    createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer,
+                 memory);
+    copyBuffer(stagingBuffer, buffer, size);
+
+    vkDestroyBuffer(device, stagingBuffer, nullptr);
+    vkFreeMemory(device, stagingMemory, nullptr);
 }
 
-void createDescriptorPool() {
-    VkDescriptorPoolSize poolSize{};
-    poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    poolSize.descriptorCount = imageCount;
+// Atoms are baked at their centres and every one of their glyph vertices takes the result
+std::vector<glm::vec3> glyphCenters(const std::vector<Vertex> &vertexList, uint32_t glyphVertices) {
+    std::vector<glm::vec3> points(vertexList.size() / glyphVertices, glm::vec3(0.0f));
+    for (size_t i = 0; i < points.size() * glyphVertices; i++)
+        points[i / glyphVertices] += vertexList[i].pos / (float) glyphVertices;
+    return points;
+}
 
-    VkDescriptorPoolCreateInfo poolInfo{};
-    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    poolInfo.poolSizeCount = 1;
-    poolInfo.pPoolSizes = &poolSize;
-    poolInfo.maxSets = imageCount;
+void bakeGlyphOcclusion(const std::vector<glm::vec3> &points, const OcclusionGrid &grid, uint32_t glyphVertices,
+                        uint8_t *occlusion) {
+    std::vector<uint8_t> atoms(points.size());
+    bakeOcclusionParallel(points, grid, occlusionSettings, std::thread::hardware_concurrency(), atoms.data());
+    for (size_t i = 0; i < atoms.size() * glyphVertices; i++)
+        occlusion[i] = atoms[i / glyphVertices];
+}
 
-    vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool);
+// The shader reads every point and writes whole words, both have to fit a single storage buffer binding
+bool occlusionComputeFits(size_t pointCount, VkDeviceSize outputSize) {
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+    return occlusionCompute && sizeof(glm::vec4) * pointCount <= deviceProperties.limits.maxStorageBufferRange &&
+           outputSize <= deviceProperties.limits.maxStorageBufferRange;
 }
 
-void createDescriptorSets() {
-    std::vector<VkDescriptorSetLayout> layouts(imageCount, descriptorSetLayout);
+// One dispatch over the whole structure, the grid is sorted on the CPU and only read by the shader. The target is
+// either handed to the graphics queue or, for a readback, made visible to the host once the job's value is reached
+void bakeOcclusionCompute(ComputeJob &job, const std::vector<glm::vec3> &points, const OcclusionGrid &grid,
+                          uint32_t glyphVertices, VkBuffer target, bool readback) {
+    job.shader = readShader("shaders/occlusion.comp.spv");
+
+    std::vector<glm::vec4> positions(points.size());
+    for (size_t i = 0; i < points.size(); i++)
+        positions[i] = glm::vec4(points[i], 1.0f);
+
+    std::vector<VkBuffer> &buffers = job.buffers;
+    std::vector<VkDeviceMemory> &memories = job.memories;
+    buffers.resize(3);
+    memories.resize(3);
+    createHostBuffer(positions.data(), sizeof(glm::vec4) * positions.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                     buffers[0], memories[0]);
+    createHostBuffer(grid.cellStarts.data(), sizeof(uint32_t) * grid.cellStarts.size(),
+                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, buffers[1], memories[1]);
+    createHostBuffer(grid.pointIndices.data(), sizeof(uint32_t) * grid.pointIndices.size(),
+                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, buffers[2], memories[2]);
+    buffers.push_back(target);
+
+    std::vector<VkDescriptorSetLayoutBinding> layoutBindings(buffers.size());
+    for (uint32_t i = 0; i < buffers.size(); i++) {
+        layoutBindings[i].binding = i;
+        layoutBindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        layoutBindings[i].descriptorCount = 1;
+        layoutBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
 
-    VkDescriptorSetAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    allocInfo.descriptorPool = descriptorPool;
-    allocInfo.descriptorSetCount = imageCount;
-    allocInfo.pSetLayouts = layouts.data();
+    VkDescriptorSetLayoutCreateInfo descriptorInfo{};
+    descriptorInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descriptorInfo.bindingCount = layoutBindings.size();
+    descriptorInfo.pBindings = layoutBindings.data();
 
-    descriptorSets.resize(imageCount);
-    vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data());
+    vkCreateDescriptorSetLayout(device, &descriptorInfo, nullptr, &job.setLayout);
 
-    for (size_t i = 0; i < imageCount; i++) {
-        VkDescriptorBufferInfo bufferInfo{};
-        bufferInfo.buffer = uniformBuffers[i];
-        bufferInfo.offset = 0;
-        bufferInfo.range = sizeof(Transform);
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(OcclusionBake);
+
+    VkPipelineLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &job.setLayout;
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &pushConstantRange;
+
+    vkCreatePipelineLayout(device, &layoutInfo, nullptr, &job.layout);
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = job.shader;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = job.layout;
+
+    vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &job.pipeline);
+
+    VkDescriptorPoolSize poolSize{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, (uint32_t) buffers.size()};
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    poolInfo.maxSets = 1;
 
-        VkWriteDescriptorSet descriptorWrite{};
-        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrite.dstSet = descriptorSets[i];
-        descriptorWrite.dstBinding = 0;
-        descriptorWrite.dstArrayElement = 0;
-        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        descriptorWrite.descriptorCount = 1;
-        descriptorWrite.pBufferInfo = &bufferInfo;
-        descriptorWrite.pImageInfo = nullptr;
-        descriptorWrite.pTexelBufferView = nullptr;
+    vkCreateDescriptorPool(device, &poolInfo, nullptr, &job.pool);
 
-        vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = job.pool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &job.setLayout;
+
+    VkDescriptorSet descriptorSet;
+    vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet);
+
+    std::vector<VkDescriptorBufferInfo> bufferInfos(buffers.size());
+    std::vector<VkWriteDescriptorSet> descriptorWrites(buffers.size());
+    for (uint32_t i = 0; i < buffers.size(); i++) {
+        bufferInfos[i] = {buffers[i], 0, VK_WHOLE_SIZE};
+
+        descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[i].dstSet = descriptorSet;
+        descriptorWrites[i].dstBinding = i;
+        descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrites[i].descriptorCount = 1;
+        descriptorWrites[i].pBufferInfo = &bufferInfos[i];
     }
-}
+    vkUpdateDescriptorSets(device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+
+    uint32_t vertexCount = points.size() * glyphVertices;
+    OcclusionBake bake{};
+    bake.origin = glm::vec4(grid.origin, grid.cellSize);
+    bake.dimensions = glm::uvec4(grid.dimensions, vertexCount);
+    bake.settings = glm::vec4(occlusionSettings.radius, occlusionSettings.saturation, occlusionSettings.strength,
+                              glyphVertices);
 
-void createCommandBuffers() {
     VkCommandBufferAllocateInfo allocateInfo{};
     allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocateInfo.commandPool = commandPool;
     allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocateInfo.commandBufferCount = imageCount;
+    allocateInfo.commandPool = computePool;
+    allocateInfo.commandBufferCount = 1;
+    vkAllocateCommandBuffers(device, &allocateInfo, &job.commandBuffer);
 
-    commandBuffers.resize(imageCount);
-    vkAllocateCommandBuffers(device, &allocateInfo, commandBuffers.data());
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
-    for (size_t i = 0; i < imageCount; i++) {
-        VkCommandBufferBeginInfo beginInfo{};
-        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        beginInfo.pInheritanceInfo = nullptr;
+    vkBeginCommandBuffer(job.commandBuffer, &beginInfo);
+    vkCmdBindPipeline(job.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, job.pipeline);
+    vkCmdBindDescriptorSets(job.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, job.layout, 0, 1, &descriptorSet,
+                            0, nullptr);
+    vkCmdPushConstants(job.commandBuffer, job.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(OcclusionBake),
+                       &bake);
+    vkCmdDispatch(job.commandBuffer, (vertexCount + 255) / 256, 1, 1);
+
+    // The semaphore makes the writes visible, a separate family also has to hand the buffer over
+    if (readback) {
+        VkBufferMemoryBarrier barrier = ownershipBarrier(target, 0, VK_WHOLE_SIZE, VK_QUEUE_FAMILY_IGNORED,
+                                                         VK_QUEUE_FAMILY_IGNORED);
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(job.commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                             0, 0, nullptr, 1, &barrier, 0, nullptr);
+    } else if (computeFamily != graphicsFamily) {
+        VkBufferMemoryBarrier release = ownershipBarrier(target, 0, VK_WHOLE_SIZE, computeFamily,
+                                                         graphicsFamily);
+        release.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(job.commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &release, 0, nullptr);
+    }
+    vkEndCommandBuffer(job.commandBuffer);
 
-        std::vector<VkClearValue> clearValues{{0.0f, 0.0f, 0.0f, 1.0f},
-                                              {1.0f, 0}};
+    job.value = submitTimeline(computeQueue, computeTimeline, {job.commandBuffer}, {});
+}
 
-        VkRenderPassBeginInfo renderPassInfo{};
-        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-        renderPassInfo.renderPass = renderPass;
-        renderPassInfo.framebuffer = framebuffers[i];
-        renderPassInfo.renderArea.offset = {0, 0};
-        renderPassInfo.renderArea.extent = swapchainExtent;
-        renderPassInfo.clearValueCount = clearValues.size();
-        renderPassInfo.pClearValues = clearValues.data();
+void releaseComputeJob(ComputeJob &job) {
+    waitTimeline(computeTimeline, job.value);
+
+    vkFreeCommandBuffers(device, computePool, 1, &job.commandBuffer);
+    vkDestroyDescriptorPool(device, job.pool, nullptr);
+    vkDestroyPipeline(device, job.pipeline, nullptr);
+    vkDestroyPipelineLayout(device, job.layout, nullptr);
+    vkDestroyDescriptorSetLayout(device, job.setLayout, nullptr);
+    vkDestroyShaderModule(device, job.shader, nullptr);
+    for (size_t i = 0; i < job.memories.size(); i++) {
+        vkDestroyBuffer(device, job.buffers[i], nullptr);
+        vkFreeMemory(device, job.memories[i], nullptr);
+    }
+    job = {};
+}
 
-        std::vector<VkDeviceSize> offsets{0};
+// Blocks until the bake is done, used where the result is written out rather than drawn
+void readOcclusionCompute(const std::vector<glm::vec3> &points, const OcclusionGrid &grid, uint32_t glyphVertices,
+                          std::vector<uint8_t> &occlusion) {
+    VkBuffer output;
+    VkDeviceMemory outputMemory;
+    createBuffer(occlusion.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, output, outputMemory);
 
-        vkBeginCommandBuffer(commandBuffers[i], &beginInfo);
-        vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-        vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, &vertexBuffer, offsets.data());
-        vkCmdBindIndexBuffer(commandBuffers[i], indexBuffer, 0, VK_INDEX_TYPE_UINT16);
-        vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout,
-                                0, 1, &descriptorSets[i], 0, nullptr);
+    ComputeJob job{};
+    bakeOcclusionCompute(job, points, grid, glyphVertices, output, true);
+    releaseComputeJob(job);
+
+    void *data;
+    vkMapMemory(device, outputMemory, 0, occlusion.size(), 0, &data);
+    memcpy(occlusion.data(), data, occlusion.size());
+    vkUnmapMemory(device, outputMemory);
+    vkDestroyBuffer(device, output, nullptr);
+    vkFreeMemory(device, outputMemory, nullptr);
+}
 
-        vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, leftGraphicsPipeline);
-        vkCmdDrawIndexed(commandBuffers[i], indices.size(), 1, 0, 0, 0);
+// One 8-bit visibility per vertex, baked on the compute queue while setup carries on and waited for by the first
+// scene submission
+void createOcclusionBuffer() {
+    std::vector<glm::vec3> points = glyphCenters(vertexData, atomVertices);
 
-        vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS,
-                          rightGraphicsPipeline);
-        vkCmdDrawIndexed(commandBuffers[i], indices.size(), 1, 0, 0, 0);
+    OcclusionGrid grid;
+    buildOcclusionGrid(points, occlusionSettings.radius, grid);
 
-        vkCmdEndRenderPass(commandBuffers[i]);
-        vkEndCommandBuffer(commandBuffers[i]);
+    // Rounded up to whole words for the compute shader, which writes four vertices at a time
+    VkDeviceSize bufferSize = (vertexData.size() + 3) / 4 * 4;
+
+    if (occlusionComputeFits(points.size(), bufferSize)) {
+        createBuffer(bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, occlusionBuffer, occlusionMemory);
+        bakeOcclusionCompute(occlusionJob, points, grid, atomVertices, occlusionBuffer, false);
+        occlusionPending = true;
+        return;
     }
+
+    std::vector<uint8_t> occlusion(bufferSize, 255);
+    bakeGlyphOcclusion(points, grid, atomVertices, occlusion.data());
+    createDeviceBuffer(occlusion.data(), bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, occlusionBuffer,
+                       occlusionMemory);
 }
 
-void createSyncObject() {
-    currentImage = 0;
+void extractFrustum(const glm::mat4 &matrix, glm::vec4 planes[6]) {
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; i++)
+        rows[i] = glm::vec4(matrix[0][i], matrix[1][i], matrix[2][i], matrix[3][i]);
 
-    frameFences.resize(imageCount);
-    orderFences.resize(imageCount, VK_NULL_HANDLE);
-    availableSemaphores.resize(imageCount);
-    finishedSemaphores.resize(imageCount);
+    planes[0] = rows[3] + rows[0];
+    planes[1] = rows[3] - rows[0];
+    planes[2] = rows[3] + rows[1];
+    planes[3] = rows[3] - rows[1];
+    planes[4] = rows[2];
+    planes[5] = rows[3] - rows[2];
 
-    VkFenceCreateInfo fenceInfo{};
-    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+    for (int i = 0; i < 6; i++)
+        planes[i] /= glm::length(glm::vec3(planes[i]));
+}
 
-    VkSemaphoreCreateInfo semaphoreInfo{};
-    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+bool intersectsSphere(const glm::vec4 planes[6], const glm::vec3 &center, float radius) {
+    for (int i = 0; i < 6; i++)
+        if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius)
+            return false;
+    return true;
+}
 
-    for (size_t i = 0; i < imageCount; i++) {
-        vkCreateFence(device, &fenceInfo, nullptr, &frameFences[i]);
-        vkCreateSemaphore(device, &semaphoreInfo, nullptr, &availableSemaphores[i]);
-        vkCreateSemaphore(device, &semaphoreInfo, nullptr, &finishedSemaphores[i]);
+bool intersectsFrustum(const glm::vec4 planes[6], const glm::vec3 &minimum,
+                       const glm::vec3 &maximum, float margin) {
+    for (int i = 0; i < 6; i++) {
+        glm::vec3 corner(planes[i].x > 0.0f ? maximum.x : minimum.x,
+                         planes[i].y > 0.0f ? maximum.y : minimum.y,
+                         planes[i].z > 0.0f ? maximum.z : minimum.z);
+        if (glm::dot(glm::vec3(planes[i]), corner) + planes[i].w < -margin)
+            return false;
     }
+    return true;
 }
 
-void setup() {
-    initialize();
-    pickDevice();
-    createSwapchain();
+// The union of the eye frusta is no frustum itself, so each eye is tested on its own
+void extractEyeFrusta(glm::vec4 planes[2][6]) {
+    extractFrustum(cullMatrices[0], planes[0]);
+    extractFrustum(cullMatrices[1], planes[1]);
+}
+
+float operatorScale(const glm::mat4 &matrix) {
+    return glm::max(glm::length(glm::vec3(matrix[0])),
+                    glm::max(glm::length(glm::vec3(matrix[1])), glm::length(glm::vec3(matrix[2]))));
+}
+
+// Occlusion is baked over the whole structure first, so atoms at chunk borders still see their neighbours
+void writeChunkFile(const std::string &path, const std::vector<Vertex> &vertexList,
+                    const std::vector<uint32_t> &indexList, float cellSize) {
+    std::vector<glm::vec3> points = glyphCenters(vertexList, importedAtomVertices);
+
+    OcclusionGrid grid;
+    buildOcclusionGrid(points, occlusionSettings.radius, grid);
+    std::vector<uint8_t> occlusion((vertexList.size() + 3) / 4 * 4, 255);
+    if (occlusionComputeFits(points.size(), occlusion.size()))
+        readOcclusionCompute(points, grid, importedAtomVertices, occlusion);
+    else
+        bakeGlyphOcclusion(points, grid, importedAtomVertices, occlusion.data());
+
+    std::map<std::tuple<int32_t, int32_t, int32_t>, std::vector<uint32_t>> cells;
+
+    for (uint32_t triangle = 0; triangle < indexList.size() / 3; triangle++) {
+        glm::vec3 centroid = (vertexList[indexList[triangle * 3]].pos +
+                              vertexList[indexList[triangle * 3 + 1]].pos +
+                              vertexList[indexList[triangle * 3 + 2]].pos) / 3.0f;
+        glm::ivec3 cell = glm::floor(centroid / cellSize);
+        cells[std::make_tuple(cell.x, cell.y, cell.z)].push_back(triangle);
+    }
+
+    std::vector<ChunkFileRecord> records;
+    std::vector<std::vector<Vertex>> chunkVertices;
+    std::vector<std::vector<uint16_t>> chunkIndices;
+    std::vector<std::vector<uint8_t>> chunkOcclusion;
+    ChunkFileHeader header{{'M', 'V', 'R', 'C'}, 2, 0, 0, 0};
+
+    for (auto &cell : cells) {
+        std::unordered_map<uint32_t, uint16_t> remap;
+
+        for (size_t i = 0; i < cell.second.size(); i++) {
+            if (i == 0 || chunkVertices.back().size() + 3 > chunkVertexLimit ||
+                    chunkIndices.back().size() + 3 > chunkIndexLimit) {
+                chunkVertices.emplace_back();
+                chunkIndices.emplace_back();
+                chunkOcclusion.emplace_back();
+                remap.clear();
+            }
+
+            for (uint32_t corner = 0; corner < 3; corner++) {
+                uint32_t index = indexList[cell.second[i] * 3 + corner];
+                auto found = remap.find(index);
+                if (found == remap.end()) {
+                    found = remap.emplace(index, chunkVertices.back().size()).first;
+                    chunkVertices.back().push_back(vertexList[index]);
+                    chunkOcclusion.back().push_back(occlusion[index]);
+                }
+                chunkIndices.back().push_back(found->second);
+            }
+        }
+    }
+
+    header.chunkCount = chunkVertices.size();
+    uint64_t offset = sizeof(ChunkFileHeader) + sizeof(ChunkFileRecord) * header.chunkCount;
+
+    for (size_t i = 0; i < chunkVertices.size(); i++) {
+        glm::vec3 minimum(FLT_MAX), maximum(-FLT_MAX);
+        for (auto &vertex : chunkVertices[i]) {
+            minimum = glm::min(minimum, vertex.pos);
+            maximum = glm::max(maximum, vertex.pos);
+        }
+
+        ChunkFileRecord record{{minimum.x, minimum.y, minimum.z},
+                               {maximum.x, maximum.y, maximum.z}, offset,
+                               (uint32_t) chunkVertices[i].size(), (uint32_t) chunkIndices[i].size()};
+        records.push_back(record);
+
+        header.maxVertices = std::max(header.maxVertices, record.vertexCount);
+        header.maxIndices = std::max(header.maxIndices, record.indexCount);
+        offset += record.vertexCount * (6 * sizeof(float) + sizeof(uint8_t)) + record.indexCount * sizeof(uint16_t);
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    file.write((const char *) &header, sizeof(ChunkFileHeader));
+    file.write((const char *) records.data(), sizeof(ChunkFileRecord) * records.size());
+
+    for (size_t i = 0; i < chunkVertices.size(); i++) {
+        for (auto &vertex : chunkVertices[i]) {
+            float data[6] = {vertex.pos.x, vertex.pos.y, vertex.pos.z,
+                             vertex.col.x, vertex.col.y, vertex.col.z};
+            file.write((const char *) data, sizeof(data));
+        }
+        file.write((const char *) chunkIndices[i].data(), sizeof(uint16_t) * chunkIndices[i].size());
+        file.write((const char *) chunkOcclusion[i].data(), sizeof(uint8_t) * chunkOcclusion[i].size());
+    }
+}
+
+glm::vec3 elementColor(const std::string &element) {
+    static const std::map<std::string, glm::vec3> colors = {
+            {"H", {1.0f, 1.0f, 1.0f}},
+            {"C", {0.5f, 0.5f, 0.5f}},
+            {"N", {0.2f, 0.3f, 1.0f}},
+            {"O", {1.0f, 0.1f, 0.1f}},
+            {"P", {1.0f, 0.5f, 0.0f}},
+            {"S", {1.0f, 0.8f, 0.2f}}
+    };
+
+    auto found = colors.find(element);
+    return found != colors.end() ? found->second : glm::vec3(1.0f, 0.4f, 0.7f);
+}
+
+// Every ATOM and HETATM record becomes a small octahedron, colored by element
+bool importStructure(const std::string &path, std::vector<Vertex> &vertexList, std::vector<uint32_t> &indexList) {
+    static const glm::vec3 corners[6] = {{1.0f,  0.0f,  0.0f}, {-1.0f, 0.0f, 0.0f}, {0.0f, 1.0f,  0.0f},
+                                         {0.0f,  -1.0f, 0.0f}, {0.0f,  0.0f, 1.0f}, {0.0f, 0.0f, -1.0f}};
+    static const uint32_t faces[24] = {0, 2, 4, 2, 1, 4, 1, 3, 4, 3, 0, 4,
+                                       2, 0, 5, 1, 2, 5, 3, 1, 5, 0, 3, 5};
+
+    std::ifstream file(path);
+    if (!file)
+        return false;
+
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.size() < 54 || (line.compare(0, 6, "ATOM  ") != 0 && line.compare(0, 6, "HETATM") != 0))
+            continue;
+
+        glm::vec3 position(std::strtof(line.substr(30, 8).c_str(), nullptr),
+                           std::strtof(line.substr(38, 8).c_str(), nullptr),
+                           std::strtof(line.substr(46, 8).c_str(), nullptr));
+
+        // Older files leave the element columns empty, the atom name starts with it then
+        std::string element = line.size() >= 78 ? line.substr(76, 2) : line.substr(12, 2);
+        element.erase(std::remove(element.begin(), element.end(), ' '), element.end());
+        glm::vec3 color = elementColor(element);
+
+        uint32_t base = vertexList.size();
+        for (auto &corner : corners)
+            vertexList.push_back({position + atomRadius * corner, color});
+        for (auto face : faces)
+            indexList.push_back(base + face);
+    }
+
+    return !indexList.empty();
+}
+
+bool loadChunkFile(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    ChunkFileHeader header{};
+    file.read((char *) &header, sizeof(ChunkFileHeader));
+    if (!file || memcmp(header.magic, "MVRC", 4) != 0 || header.version != 2 ||
+            header.maxVertices > chunkVertexLimit || header.maxIndices > chunkIndexLimit) {
+        LOG("Ignoring invalid chunk file %s\n", path.c_str());
+        return false;
+    }
+
+    std::vector<ChunkFileRecord> records(header.chunkCount);
+    file.read((char *) records.data(), sizeof(ChunkFileRecord) * records.size());
+    if (!file)
+        return false;
+
+    chunkMaxVertices = header.maxVertices;
+    chunkMaxIndices = header.maxIndices;
+    chunks.clear();
+
+    glm::vec3 minimum(FLT_MAX), maximum(-FLT_MAX);
+
+    for (auto &record : records) {
+        Chunk chunk{};
+        chunk.minimum = glm::vec3(record.minimum[0], record.minimum[1], record.minimum[2]);
+        chunk.maximum = glm::vec3(record.maximum[0], record.maximum[1], record.maximum[2]);
+        chunk.offset = record.offset;
+        chunk.vertexCount = record.vertexCount;
+        chunk.indexCount = record.indexCount;
+        chunk.slot = -1;
+        chunks.push_back(chunk);
+
+        minimum = glm::min(minimum, chunk.minimum);
+        maximum = glm::max(maximum, chunk.maximum);
+    }
+
+    // One range for every chunk keeps a single offset and scale per draw
+    quantizeVertexLayout(chunkLayout, minimum, maximum);
+    return true;
+}
+
+void streamChunks() {
+    std::ifstream file(chunkPath, std::ios::binary);
+    std::unique_lock<std::mutex> lock(streamMutex);
+
+    while (true) {
+        streamCondition.wait(lock, [] { return !streamRunning || !streamRequests.empty(); });
+        if (!streamRunning)
+            break;
+
+        ChunkData data{};
+        data.chunk = streamRequests.front();
+        streamRequests.pop_front();
+
+        uint64_t offset = chunks[data.chunk].offset;
+        uint32_t vertexCount = chunks[data.chunk].vertexCount;
+        uint32_t indexCount = chunks[data.chunk].indexCount;
+        lock.unlock();
+
+        std::vector<float> vertexData(vertexCount * 6);
+        data.vertices.resize(chunkLayout.stride * vertexCount);
+        data.indices.resize(indexCount);
+
+        data.occlusion.resize(vertexCount);
+
+        file.seekg(offset);
+        file.read((char *) vertexData.data(), sizeof(float) * vertexData.size());
+        file.read((char *) data.indices.data(), sizeof(uint16_t) * indexCount);
+        file.read((char *) data.occlusion.data(), sizeof(uint8_t) * vertexCount);
+
+        for (uint32_t i = 0; i < vertexCount; i++) {
+            glm::vec3 position(vertexData[i * 6], vertexData[i * 6 + 1], vertexData[i * 6 + 2]);
+            glm::vec3 color(vertexData[i * 6 + 3], vertexData[i * 6 + 4], vertexData[i * 6 + 5]);
+            encodeVertex(chunkLayout, {position, glm::vec3(0.0f), file ? paletteColor(color) : 0},
+                         data.vertices.data() + chunkLayout.stride * i);
+        }
+
+        lock.lock();
+        if (!file) {
+            LOG("Failed to read chunk %u\n", data.chunk);
+            file.clear();
+            data.vertices.clear();
+            data.indices.clear();
+            data.occlusion.clear();
+        }
+        streamResults.push_back(std::move(data));
+    }
+}
+
+// A structure dropped next to the chunk file becomes the asymmetric unit every assembly operator draws. Small ones
+// stay resident in vertexData, large ones are converted once and later launches stream the cached chunks
+void loadStructure() {
+    if (structureResident || !app->activity->externalDataPath)
+        return;
+
+    std::string directory(app->activity->externalDataPath);
+    chunkPath = directory + "/structure.mvrc";
+    structureStreamed = false;
+
+    size_t cachedVertices = 0;
+    if (loadChunkFile(chunkPath))
+        for (auto &chunk : chunks)
+            cachedVertices += chunk.vertexCount;
+
+    // Large caches are streamed without parsing their source again, a cache without its source whatever its size
+    std::vector<Vertex> vertexList;
+    std::vector<uint32_t> indexList;
+    if (cachedVertices > residentVertexLimit ||
+            !importStructure(directory + "/structure.pdb", vertexList, indexList)) {
+        structureStreamed = cachedVertices > 0;
+        return;
+    }
+
+    if (vertexList.size() <= residentVertexLimit) {
+        LOG("Drawing %zu atoms from %s/structure.pdb\n", vertexList.size() / importedAtomVertices,
+            directory.c_str());
+        vertexData = std::move(vertexList);
+        indexData = std::move(indexList);
+        atomVertices = importedAtomVertices;
+        structureResident = true;
+        return;
+    }
+
+    LOG("Chunking %zu atoms into %s\n", vertexList.size() / importedAtomVertices, chunkPath.c_str());
+    writeChunkFile(chunkPath, vertexList, indexList, chunkCellSize);
+    structureStreamed = loadChunkFile(chunkPath) && !chunks.empty();
+}
+
+void createChunkBuffers() {
+    if (!structureStreamed)
+        return;
+
+    // The chunks replace the structure in the assembly, so operators are culled against their bounds
+    glm::vec3 minimum(FLT_MAX), maximum(-FLT_MAX);
+    for (auto &chunk : chunks) {
+        minimum = glm::min(minimum, chunk.minimum);
+        maximum = glm::max(maximum, chunk.maximum);
+    }
+    assemblyCenter = (minimum + maximum) / 2.0f;
+    assemblyRadius = glm::length(maximum - assemblyCenter);
+
+    VkDeviceSize slotSize = chunkMaxVertices * (chunkLayout.stride + sizeof(uint8_t)) +
+            chunkMaxIndices * sizeof(uint16_t);
+    uint32_t slotCount = std::min<VkDeviceSize>(chunks.size(), chunkMemoryBudget / slotSize);
+    chunkSlots.resize(slotCount, -1);
+    LOG("Streaming %zu chunks through %u resident slots\n", chunks.size(), slotCount);
+
+    createBuffer(chunkMaxVertices * chunkLayout.stride * slotCount,
+                 VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, chunkVertexBuffer, chunkVertexMemory);
+    createBuffer(chunkMaxIndices * sizeof(uint16_t) * slotCount,
+                 VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, chunkIndexBuffer, chunkIndexMemory);
+    createBuffer(chunkMaxVertices * sizeof(uint8_t) * slotCount,
+                 VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, chunkOcclusionBuffer, chunkOcclusionMemory);
+
+    chunkStagingBuffers.resize(eyeImageCount);
+    chunkStagingMemories.resize(eyeImageCount);
+    chunkStagingMappings.resize(eyeImageCount);
+
+    for (size_t i = 0; i < eyeImageCount; i++) {
+        createBuffer(chunkUploadBudget, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                     chunkStagingBuffers[i], chunkStagingMemories[i]);
+        vkMapMemory(device, chunkStagingMemories[i], 0, VK_WHOLE_SIZE, 0,
+                    &chunkStagingMappings[i]);
+    }
+
+    streamRunning = true;
+    streamThread = std::thread(streamChunks);
+}
+
+std::vector<std::string> splitFields(const std::string &line) {
+    std::vector<std::string> fields;
+    size_t position = 0;
+
+    while (position < line.size()) {
+        while (position < line.size() && isspace(line[position]))
+            position++;
+        if (position == line.size())
+            break;
+
+        char quote = line[position];
+        if (quote == '\'' || quote == '"') {
+            size_t end = line.find(quote, position + 1);
+            if (end == std::string::npos)
+                end = line.size();
+            fields.push_back(line.substr(position + 1, end - position - 1));
+            position = end + 1;
+        } else {
+            size_t start = position;
+            while (position < line.size() && !isspace(line[position]))
+                position++;
+            fields.push_back(line.substr(start, position - start));
+        }
+    }
+
+    return fields;
+}
+
+void setOperatorElement(glm::mat4 &matrix, const std::string &name, float value) {
+    int row, column;
+    if (sscanf(name.c_str(), "matrix[%d][%d]", &row, &column) == 2 &&
+            row >= 1 && row <= 3 && column >= 1 && column <= 3)
+        matrix[column - 1][row - 1] = value;
+    else if (sscanf(name.c_str(), "vector[%d]", &row) == 1 && row >= 1 && row <= 3)
+        matrix[3][row - 1] = value;
+}
+
+// Rows of the requested categories, whether written as a loop or as key-value pairs. Reading stops at the
+// first unrequested loop once every category has been seen, which keeps the atom records unread
+void readCifCategories(std::istream &stream, std::map<std::string, CifRows> &categories) {
+    std::vector<std::string> columns, values;
+    CifRows *rows = nullptr;
+    std::string line;
+    bool looping = false;
+
+    while (std::getline(stream, line)) {
+        if (line.compare(0, 5, "loop_") == 0) {
+            looping = true;
+            rows = nullptr;
+            columns.clear();
+            values.clear();
+            continue;
+        }
+
+        if (line.empty() || line[0] == '#') {
+            looping = false;
+            rows = nullptr;
+            continue;
+        }
+
+        if (line[0] == '_') {
+            auto fields = splitFields(line);
+            size_t dot = fields[0].find('.');
+            auto found = categories.find(fields[0].substr(0, dot + 1));
+            std::string key = fields[0].substr(dot + 1);
+
+            if (looping) {
+                if (columns.empty() && found == categories.end() &&
+                        std::all_of(categories.begin(), categories.end(),
+                                    [](const std::pair<const std::string, CifRows> &category) {
+                                        return !category.second.empty();
+                                    }))
+                    return;
+                rows = found != categories.end() ? &found->second : nullptr;
+                columns.push_back(key);
+            } else if (found != categories.end() && fields.size() > 1) {
+                if (found->second.empty())
+                    found->second.emplace_back();
+                found->second.back()[key] = fields[1];
+            }
+            continue;
+        }
+
+        looping = false;
+        if (!rows)
+            continue;
+
+        for (auto &field : splitFields(line)) {
+            values.push_back(field);
+            if (values.size() < columns.size())
+                continue;
+
+            rows->emplace_back();
+            for (size_t i = 0; i < columns.size(); i++)
+                rows->back()[columns[i]] = values[i];
+            values.clear();
+        }
+    }
+}
+
+// Parenthesized groups multiply left to right, so "(X0)(1-60)" applies X0 after each of 1 to 60
+void expandOperatorExpression(const std::string &expression, const std::map<std::string, glm::mat4> &named,
+                              std::vector<glm::mat4> &operators) {
+    std::vector<std::string> groups;
+    for (size_t position = 0; position < expression.size();) {
+        size_t open = expression.find('(', position);
+        if (open == std::string::npos) {
+            if (groups.empty())
+                groups.push_back(expression);
+            break;
+        }
+        size_t close = expression.find(')', open);
+        groups.push_back(expression.substr(open + 1, close - open - 1));
+        position = close == std::string::npos ? expression.size() : close + 1;
+    }
+
+    std::vector<glm::mat4> products{glm::mat4(1.0f)};
+    for (auto &group : groups) {
+        std::vector<std::string> ids;
+        std::stringstream items(group);
+        std::string item;
+
+        while (std::getline(items, item, ',')) {
+            int first, last;
+            char separator;
+            std::stringstream range(item);
+            if (range >> first >> separator >> last && separator == '-')
+                for (int id = first; id <= last; id++)
+                    ids.push_back(std::to_string(id));
+            else
+                ids.push_back(item);
+        }
+
+        std::vector<glm::mat4> expanded;
+        for (auto &product : products)
+            for (auto &id : ids) {
+                auto found = named.find(id);
+                if (found != named.end())
+                    expanded.push_back(product * found->second);
+            }
+        products = expanded;
+    }
+
+    operators.insert(operators.end(), products.begin(), products.end());
+}
+
+// Only the first assembly is drawn, matching the first biomolecule taken from PDB files
+std::vector<glm::mat4> readStructOperators(std::istream &stream) {
+    const std::string operatorCategory = "_pdbx_struct_oper_list.", generatorCategory = "_pdbx_struct_assembly_gen.";
+    std::map<std::string, CifRows> categories{{operatorCategory,  {}},
+                                              {generatorCategory, {}}};
+    readCifCategories(stream, categories);
+
+    std::map<std::string, glm::mat4> named;
+    for (auto &row : categories[operatorCategory]) {
+        glm::mat4 matrix(1.0f);
+        for (auto &field : row)
+            if (field.second != "?" && field.second != ".")
+                setOperatorElement(matrix, field.first, std::strtof(field.second.c_str(), nullptr));
+        named[row["id"]] = matrix;
+    }
+
+    std::vector<glm::mat4> operators;
+    std::vector<std::string> expressions;
+    auto &generators = categories[generatorCategory];
+
+    for (auto &row : generators) {
+        if (row["assembly_id"] != generators[0]["assembly_id"] ||
+                std::find(expressions.begin(), expressions.end(), row["oper_expression"]) != expressions.end())
+            continue;
+        expressions.push_back(row["oper_expression"]);
+        expandOperatorExpression(row["oper_expression"], named, operators);
+    }
+
+    // Without generators only numbered operators are used, lettered ones like P and X0 change frames
+    if (generators.empty())
+        for (auto &entry : named)
+            if (!entry.first.empty() && isdigit(entry.first[0]))
+                operators.push_back(entry.second);
+
+    return operators;
+}
+
+std::vector<glm::mat4> readBiomtOperators(std::istream &stream) {
+    std::vector<glm::mat4> operators;
+    std::string line;
+    int biomolecules = 0;
+
+    while (std::getline(stream, line)) {
+        if (line.compare(0, 10, "REMARK 350") != 0)
+            continue;
+
+        auto fields = splitFields(line);
+        if (fields.size() >= 3 && fields[2] == "BIOMOLECULE:" && ++biomolecules > 1)
+            break;
+        if (fields.size() < 8 || fields[2].compare(0, 5, "BIOMT") != 0)
+            continue;
+
+        int row = fields[2][5] - '1';
+        if (row < 0 || row > 2)
+            continue;
+        if (row == 0)
+            operators.emplace_back(1.0f);
+        if (operators.empty())
+            continue;
+
+        for (int column = 0; column < 3; column++)
+            operators.back()[column][row] = std::strtof(fields[4 + column].c_str(), nullptr);
+        operators.back()[3][row] = std::strtof(fields[7].c_str(), nullptr);
+    }
+
+    return operators;
+}
+
+void loadAssemblyOperators() {
+    assemblyOperators.clear();
+
+    if (app->activity->externalDataPath) {
+        std::string path(app->activity->externalDataPath);
+        std::ifstream cif(path + "/assembly.cif"), pdb(path + "/assembly.pdb");
+
+        if (cif)
+            assemblyOperators = readStructOperators(cif);
+        else if (pdb)
+            assemblyOperators = readBiomtOperators(pdb);
+    }
+
+    // Without an assembly file a real structure is drawn once, the demo is spread over a grid
+    if (assemblyOperators.empty() && (structureResident || structureStreamed))
+        assemblyOperators.emplace_back(1.0f);
+    else if (assemblyOperators.empty())
+        for (int i = -1; i <= 1; i++)
+            for (int j = -1; j <= 1; j++)
+                assemblyOperators.push_back(
+                        glm::translate(glm::mat4(1.0f), glm::vec3(i * 2.0f, j * 2.0f, 0.0f)));
+
+    LOG("Drawing assembly with %zu instances\n", assemblyOperators.size());
+}
+
+void createInstanceBuffers() {
+    loadAssemblyOperators();
+
+    VkDeviceSize bufferSize = sizeof(glm::mat4) * assemblyOperators.size();
+
+    instanceBuffers.resize(eyeImageCount);
+    instanceMemories.resize(eyeImageCount);
+    instanceMappings.resize(eyeImageCount);
+
+    for (size_t i = 0; i < eyeImageCount; i++) {
+        createBuffer(bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                     instanceBuffers[i], instanceMemories[i]);
+        vkMapMemory(device, instanceMemories[i], 0, VK_WHOLE_SIZE, 0, &instanceMappings[i]);
+    }
+}
+
+void createIndirectBuffers() {
+    VkDeviceSize bufferSize = sizeof(VkDrawIndexedIndirectCommand) * (chunkSlots.size() + 1);
+
+    indirectBuffers.resize(eyeImageCount);
+    indirectMemories.resize(eyeImageCount);
+    indirectMappings.resize(eyeImageCount);
+
+    for (size_t i = 0; i < eyeImageCount; i++) {
+        createBuffer(bufferSize, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                     indirectBuffers[i], indirectMemories[i]);
+        vkMapMemory(device, indirectMemories[i], 0, VK_WHOLE_SIZE, 0, &indirectMappings[i]);
+        memset(indirectMappings[i], 0, bufferSize);
+    }
+}
+
+void createTrajectoryBuffers() {
+    uint32_t atomCount = 1;
+    trajectoryLoaded = false;
+
+    if (app->activity->externalDataPath) {
+        std::string directory = std::string(app->activity->externalDataPath);
+        player.file.descriptor = -1;
+        player.file.mapping = nullptr;
+
+        if (!structureStreamed && (openTrajectory(directory + "/trajectory.xtc", player.file) ||
+                                   openTrajectory(directory + "/trajectory.dcd", player.file))) {
+            if (player.file.atomCount == vertexData.size() / atomVertices) {
+                atomCount = player.file.atomCount;
+                trajectoryLoaded = true;
+                LOG("Playing %zu trajectory frames of %u atoms\n",
+                    player.file.frameOffsets.size(), atomCount);
+            } else {
+                LOG("Trajectory has %u atoms but the structure has %zu\n", player.file.atomCount,
+                    vertexData.size() / atomVertices);
+                closeTrajectory(player.file);
+            }
+        }
+    }
+
+    // Slot zero holds where each atom sits in the structure, glyph vertices keep their offset from it while playing
+    VkDeviceSize frameSize = sizeof(float) * 3 * atomCount;
+    createBuffer(frameSize * (positionSlotCount + 1),
+                 VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, positionBuffer, positionMemory);
+    positionSlot = 0;
+    previousSlot = 0;
+    keyframeLoaded = false;
+    keyframeTime = 1.0f;
+
+    if (!trajectoryLoaded)
+        return;
+
+    std::vector<float> rest(3 * atomCount, 0.0f);
+    for (size_t i = 0; i < vertexData.size(); i++)
+        for (uint32_t axis = 0; axis < 3; axis++)
+            rest[3 * (i / atomVertices) + axis] += vertexData[i].pos[axis] / atomVertices;
+
+    VkBuffer restBuffer;
+    VkDeviceMemory restMemory;
+    createHostBuffer(rest.data(), frameSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, restBuffer, restMemory);
+    copyBuffer(restBuffer, positionBuffer, frameSize);
+    vkDestroyBuffer(device, restBuffer, nullptr);
+    vkFreeMemory(device, restMemory, nullptr);
+
+    std::vector<float *> slots(trajectorySlotCount);
+    trajectoryStagingBuffers.resize(trajectorySlotCount);
+    trajectoryStagingMemories.resize(trajectorySlotCount);
+    trajectoryReleases.assign(eyeImageCount, -1);
+
+    for (uint32_t i = 0; i < trajectorySlotCount; i++) {
+        createBuffer(frameSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                     trajectoryStagingBuffers[i], trajectoryStagingMemories[i]);
+        vkMapMemory(device, trajectoryStagingMemories[i], 0, VK_WHOLE_SIZE, 0, (void **) &slots[i]);
+    }
+
+    playbackTime = std::chrono::steady_clock::now();
+    uint32_t workerCount = std::max(std::thread::hardware_concurrency() / 2, 1u);
+    startPlayer(player, slots, std::min(workerCount, trajectorySlotCount - 2));
+}
+
+void createUploadCommandBuffers() {
+    VkCommandBufferAllocateInfo allocateInfo{};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocateInfo.commandPool = transferPool;
+    allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocateInfo.commandBufferCount = eyeImageCount;
+
+    uploadCommandBuffers.resize(eyeImageCount);
+    vkAllocateCommandBuffers(device, &allocateInfo, uploadCommandBuffers.data());
+}
+
+void createUniformBuffers() {
+    VkDeviceSize bufferSize = sizeof(Transform);
+
+    uniformBuffers.resize(eyeImageCount);
+    uniformMemories.resize(eyeImageCount);
+    uniformMappings.resize(eyeImageCount);
+
+    // Kept mapped so the pose can be latched right before submission without a map call in between
+    for (size_t i = 0; i < eyeImageCount; i++) {
+        createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                     uniformBuffers[i], uniformMemories[i]);
+        vkMapMemory(device, uniformMemories[i], 0, bufferSize, 0, &uniformMappings[i]);
+    }
+}
+
+void createDescriptorPool() {
+    std::vector<VkDescriptorPoolSize> poolSizes(4);
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    poolSizes[0].descriptorCount = eyeImageCount;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[1].descriptorCount = 3 * eyeImageCount;
+    poolSizes[2].type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+    poolSizes[2].descriptorCount = 2 * eyeImageCount;
+    poolSizes[3].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    poolSizes[3].descriptorCount = eyeImageCount;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = poolSizes.size();
+    poolInfo.pPoolSizes = poolSizes.data();
+    poolInfo.maxSets = eyeImageCount;
+
+    vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool);
+}
+
+void createDescriptorSets() {
+    std::vector<VkDescriptorSetLayout> layouts(eyeImageCount, descriptorSetLayout);
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = eyeImageCount;
+    allocInfo.pSetLayouts = layouts.data();
+
+    descriptorSets.resize(eyeImageCount);
+    vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data());
+
+    for (size_t i = 0; i < eyeImageCount; i++) {
+        VkDescriptorBufferInfo bufferInfo{};
+        bufferInfo.buffer = uniformBuffers[i];
+        bufferInfo.offset = 0;
+        bufferInfo.range = sizeof(Transform);
+
+        VkDescriptorBufferInfo positionInfo{};
+        positionInfo.buffer = positionBuffer;
+        positionInfo.offset = 0;
+        positionInfo.range = VK_WHOLE_SIZE;
+
+        VkDescriptorImageInfo accumulationInfo{};
+        accumulationInfo.imageView = accumulationView;
+        accumulationInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+        VkDescriptorImageInfo revealageInfo = accumulationInfo;
+        revealageInfo.imageView = revealageView;
+
+        VkDescriptorImageInfo fragmentHeadInfo{};
+        fragmentHeadInfo.imageView = fragmentHeadView;
+        fragmentHeadInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        VkDescriptorBufferInfo fragmentInfo{};
+        fragmentInfo.buffer = fragmentBuffer;
+        fragmentInfo.offset = 0;
+        fragmentInfo.range = VK_WHOLE_SIZE;
+
+        VkDescriptorBufferInfo paletteInfo{};
+        paletteInfo.buffer = paletteBuffer;
+        paletteInfo.offset = 0;
+        paletteInfo.range = VK_WHOLE_SIZE;
+
+        std::vector<VkWriteDescriptorSet> descriptorWrites(7);
+        descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[0].dstSet = descriptorSets[i];
+        descriptorWrites[0].dstBinding = 0;
+        descriptorWrites[0].dstArrayElement = 0;
+        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        descriptorWrites[0].descriptorCount = 1;
+        descriptorWrites[0].pBufferInfo = &bufferInfo;
+        descriptorWrites[0].pImageInfo = nullptr;
+        descriptorWrites[0].pTexelBufferView = nullptr;
+
+        descriptorWrites[1] = descriptorWrites[0];
+        descriptorWrites[1].dstBinding = 1;
+        descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrites[1].pBufferInfo = &positionInfo;
+
+        descriptorWrites[2] = descriptorWrites[0];
+        descriptorWrites[2].dstBinding = 2;
+        descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+        descriptorWrites[2].pBufferInfo = nullptr;
+        descriptorWrites[2].pImageInfo = &accumulationInfo;
+
+        descriptorWrites[3] = descriptorWrites[2];
+        descriptorWrites[3].dstBinding = 3;
+        descriptorWrites[3].pImageInfo = &revealageInfo;
+
+        descriptorWrites[4] = descriptorWrites[2];
+        descriptorWrites[4].dstBinding = 4;
+        descriptorWrites[4].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        descriptorWrites[4].pImageInfo = &fragmentHeadInfo;
+
+        descriptorWrites[5] = descriptorWrites[1];
+        descriptorWrites[5].dstBinding = 5;
+        descriptorWrites[5].pBufferInfo = &fragmentInfo;
+
+        descriptorWrites[6] = descriptorWrites[1];
+        descriptorWrites[6].dstBinding = 6;
+        descriptorWrites[6].pBufferInfo = &paletteInfo;
+
+        vkUpdateDescriptorSets(device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+    }
+}
+
+glm::mat4 eyeProjectionMatrix(float margin = 0.0f) {
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f) + 2.0f * margin,
+                                            (swapchainExtent.width / 2.0f) / swapchainExtent.height, 0.1f,
+                                            10.0f);
+    projection[1][1] *= -1;
+    return projection;
+}
+
+// Trajectory frames change the structure faster than occlusion can be baked, so only they pay for this pass.
+// Its GPU time is logged with the frame rate
+void createScreenOcclusion() {
+    ssaoEnabled = trajectoryLoaded;
+    ssaoShader = readShader("shaders/ssao.comp.spv");
+
+    VkDescriptorSetLayoutBinding depthLayoutBinding{};
+    depthLayoutBinding.binding = 0;
+    depthLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    depthLayoutBinding.descriptorCount = 1;
+    depthLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkDescriptorSetLayoutBinding occlusionLayoutBinding = depthLayoutBinding;
+    occlusionLayoutBinding.binding = 1;
+    occlusionLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+
+    std::vector<VkDescriptorSetLayoutBinding> layoutBindings{depthLayoutBinding, occlusionLayoutBinding};
+
+    VkDescriptorSetLayoutCreateInfo descriptorInfo{};
+    descriptorInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descriptorInfo.bindingCount = layoutBindings.size();
+    descriptorInfo.pBindings = layoutBindings.data();
+
+    vkCreateDescriptorSetLayout(device, &descriptorInfo, nullptr, &ssaoDescriptorSetLayout);
+
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(ScreenOcclusion);
+
+    VkPipelineLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &ssaoDescriptorSetLayout;
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &pushConstantRange;
+
+    vkCreatePipelineLayout(device, &layoutInfo, nullptr, &ssaoPipelineLayout);
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = ssaoShader;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = ssaoPipelineLayout;
+
+    vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &ssaoPipeline);
+
+    std::vector<VkDescriptorPoolSize> poolSizes(2);
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSizes[0].descriptorCount = eyeImageCount;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    poolSizes[1].descriptorCount = eyeImageCount;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = poolSizes.size();
+    poolInfo.pPoolSizes = poolSizes.data();
+    poolInfo.maxSets = eyeImageCount;
+
+    vkCreateDescriptorPool(device, &poolInfo, nullptr, &ssaoDescriptorPool);
+
+    std::vector<VkDescriptorSetLayout> layouts(eyeImageCount, ssaoDescriptorSetLayout);
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = ssaoDescriptorPool;
+    allocInfo.descriptorSetCount = eyeImageCount;
+    allocInfo.pSetLayouts = layouts.data();
+
+    ssaoDescriptorSets.resize(eyeImageCount);
+    vkAllocateDescriptorSets(device, &allocInfo, ssaoDescriptorSets.data());
+
+    for (size_t i = 0; i < eyeImageCount; i++) {
+        VkDescriptorImageInfo depthInfo{};
+        depthInfo.sampler = eyeSampler;
+        depthInfo.imageView = eyeDepthViews[i];
+        depthInfo.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+        VkDescriptorImageInfo occlusionInfo{};
+        occlusionInfo.imageView = eyeOcclusionViews[i];
+        occlusionInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        std::vector<VkWriteDescriptorSet> descriptorWrites(2);
+        descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[0].dstSet = ssaoDescriptorSets[i];
+        descriptorWrites[0].dstBinding = 0;
+        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWrites[0].descriptorCount = 1;
+        descriptorWrites[0].pImageInfo = &depthInfo;
+
+        descriptorWrites[1] = descriptorWrites[0];
+        descriptorWrites[1].dstBinding = 1;
+        descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        descriptorWrites[1].pImageInfo = &occlusionInfo;
+
+        vkUpdateDescriptorSets(device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+    }
+}
+
+// Both eyes sit side by side in one eye image, so a single dispatch covers them
+void recordScreenOcclusion(VkCommandBuffer commandBuffer, size_t i) {
+    glm::mat4 projection = eyeProjectionMatrix();
+
+    ScreenOcclusion occlusion{};
+    occlusion.inverseProjection = glm::inverse(projection);
+    occlusion.foveation = glm::vec4(foveaExtent, peripheryDensity,
+                                    foveaExtent + (1.0f - foveaExtent) * peripheryDensity,
+                                    multiResolution ? 1.0f : 0.0f);
+    occlusion.parameters = glm::vec4(ssaoRadius, ssaoIntensity, ssaoBias, eyeScales[i]);
+    occlusion.projection = glm::vec4(glm::abs(projection[0][0]), glm::abs(projection[1][1]), 0.0f, 0.0f);
+
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = eyeOcclusionImages[i];
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, ssaoPipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, ssaoPipelineLayout, 0, 1,
+                            &ssaoDescriptorSets[i], 0, nullptr);
+    vkCmdPushConstants(commandBuffer, ssaoPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                       sizeof(ScreenOcclusion), &occlusion);
+    vkCmdDispatch(commandBuffer, (ssaoExtent.width + 7) / 8, (ssaoExtent.height + 7) / 8, 1);
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+// The heads and count may still be read by the composite of the other eye image when they are cleared
+void clearFragmentLists(VkCommandBuffer commandBuffer) {
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    VkClearColorValue listEnd{};
+    listEnd.uint32[0] = UINT32_MAX;
+    VkImageSubresourceRange range{VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+
+    vkCmdClearColorImage(commandBuffer, fragmentHeadImage, VK_IMAGE_LAYOUT_GENERAL, &listEnd, 1, &range);
+    vkCmdFillBuffer(commandBuffer, fragmentBuffer, 0, sizeof(uint32_t), 0);
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+// Secondary buffers inherit nothing but the subpass, so each binds its own pipeline, descriptors and buffers
+void recordSceneTask(VkCommandBuffer commandBuffer, size_t i, const RecordTask &task) {
+    VkCommandBufferInheritanceInfo inheritanceInfo{};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritanceInfo.renderPass = renderPass;
+    inheritanceInfo.subpass = task.subpass;
+    inheritanceInfo.framebuffer = framebuffers[i];
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+    std::vector<VkViewport> viewports;
+    std::vector<VkRect2D> scissors;
+    foveatedRegions(task.eye, eyeScales[i], viewports, scissors);
+
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      task.subpass == 0 ? graphicsPipeline : transparentPipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout,
+                            0, 1, &descriptorSets[i], 0, nullptr);
+
+    DrawConstants constants{};
+    if (task.assembly) {
+        std::vector<VkBuffer> buffers{vertexBuffer, instanceBuffers[i], occlusionBuffer};
+        std::vector<VkDeviceSize> offsets{0, 0, 0};
+        vkCmdBindVertexBuffers(commandBuffer, 0, buffers.size(), buffers.data(), offsets.data());
+        vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+        constants = {glm::vec4(assemblyLayout.offset, 0.0f), glm::vec4(assemblyLayout.scale, 0.0f),
+                     assemblyHighlight, atomVertices, 1.0f, task.eye};
+    } else {
+        std::vector<VkBuffer> buffers{chunkVertexBuffer, instanceBuffers[i], chunkOcclusionBuffer};
+        std::vector<VkDeviceSize> offsets{0, 0, 0};
+        vkCmdBindVertexBuffers(commandBuffer, 0, buffers.size(), buffers.data(), offsets.data());
+        vkCmdBindIndexBuffer(commandBuffer, chunkIndexBuffer, 0, VK_INDEX_TYPE_UINT16);
+        constants = {glm::vec4(chunkLayout.offset, 0.0f), glm::vec4(chunkLayout.scale, 0.0f), chunkHighlight,
+                     0, glm::min(surfaceOpacity, 1.0f), task.eye};
+    }
+    vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(DrawConstants),
+                       &constants);
+
+    // The structure is the first indirect command, chunk slots follow it in order
+    for (size_t region = 0; region < viewports.size(); region++) {
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewports[region]);
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissors[region]);
+
+        if (task.assembly)
+            vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffers[i], 0, 1, sizeof(VkDrawIndexedIndirectCommand));
+        else if (deviceFeatures.multiDrawIndirect)
+            vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffers[i],
+                                     (1 + task.firstSlot) * sizeof(VkDrawIndexedIndirectCommand), task.slotCount,
+                                     sizeof(VkDrawIndexedIndirectCommand));
+        else
+            for (uint32_t slot = 1 + task.firstSlot; slot <= task.firstSlot + task.slotCount; slot++)
+                vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffers[i],
+                                         slot * sizeof(VkDrawIndexedIndirectCommand), 1,
+                                         sizeof(VkDrawIndexedIndirectCommand));
+    }
+
+    vkEndCommandBuffer(commandBuffer);
+}
+
+// Tasks are claimed one at a time, buffers come from the worker's own pool and are reused after its reset
+void drainRecordTasks(uint32_t worker) {
+    VkCommandPool pool = recordWorkers[worker].pools[recordImage];
+    std::vector<VkCommandBuffer> &buffers = recordWorkers[worker].buffers[recordImage];
+    vkResetCommandPool(device, pool, 0);
+
+    size_t used = 0;
+    for (uint32_t task = recordNext++; task < recordTasks.size(); task = recordNext++) {
+        if (used == buffers.size()) {
+            VkCommandBufferAllocateInfo allocateInfo{};
+            allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocateInfo.commandPool = pool;
+            allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            allocateInfo.commandBufferCount = 1;
+
+            buffers.emplace_back();
+            vkAllocateCommandBuffers(device, &allocateInfo, &buffers.back());
+        }
+
+        recordSceneTask(buffers[used], recordImage, recordTasks[task]);
+        recordResults[task] = buffers[used++];
+    }
+}
+
+void runRecorder(uint32_t worker) {
+    std::unique_lock<std::mutex> lock(recordMutex);
+    uint32_t generation = 0;
+
+    while (true) {
+        recordCondition.wait(lock, [&] { return !recordRunning || recordGeneration != generation; });
+        if (!recordRunning)
+            break;
+
+        generation = recordGeneration;
+        lock.unlock();
+        drainRecordTasks(worker);
+        lock.lock();
+
+        if (--recordBusy == 0)
+            recordFinished.notify_one();
+    }
+}
+
+// The render thread records alongside the workers and returns once every task has its buffer
+void recordSceneTasks(size_t i) {
+    recordImage = i;
+    recordNext = 0;
+    recordResults.resize(recordTasks.size());
+
+    {
+        std::lock_guard<std::mutex> lock(recordMutex);
+        recordBusy = recordWorkers.size() - 1;
+        recordGeneration++;
+    }
+    recordCondition.notify_all();
+    drainRecordTasks(0);
+
+    std::unique_lock<std::mutex> lock(recordMutex);
+    recordFinished.wait(lock, [] { return recordBusy == 0; });
+}
+
+// Scene command buffers are recorded every frame once residency and culling have settled the draw list
+void recordCommandBuffer(size_t i) {
+    eyeScales[i] = renderScale;
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    beginInfo.pInheritanceInfo = nullptr;
+
+    std::vector<VkClearValue> clearValues{{0.0f, 0.0f, 0.0f, 1.0f},
+                                          {1.0f, 0},
+                                          {0.0f, 0.0f, 0.0f, 0.0f},
+                                          {0.0f, 0.0f, 0.0f, 0.0f},
+                                          {1.0f, 0.0f, 0.0f, 0.0f}};
+
+    VkRenderPassBeginInfo renderPassInfo{};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassInfo.renderPass = renderPass;
+    renderPassInfo.framebuffer = framebuffers[i];
+    renderPassInfo.renderArea.offset = {0, 0};
+    renderPassInfo.renderArea.extent.width = eyeExtent.width / 2 +
+            (uint32_t) glm::ceil(eyeExtent.width / 2 * renderScale);
+    renderPassInfo.renderArea.extent.height = (uint32_t) glm::ceil(eyeExtent.height * renderScale);
+    renderPassInfo.clearValueCount = clearValues.size();
+    renderPassInfo.pClearValues = clearValues.data();
+
+    // The composite covers the render area in framebuffer space, past any multi-resolution split
+    VkViewport compositeViewport{0.0f, 0.0f, (float) renderPassInfo.renderArea.extent.width,
+                                 (float) renderPassInfo.renderArea.extent.height, 0.0f, 1.0f};
+    bool translucent = surfaceOpacity < 1.0f && !chunkSlots.empty();
+
+    // Every eye takes the structure and its chunks in groups, translucent chunks move to the second subpass
+    recordTasks.clear();
+    for (uint32_t eye = 0; eye < 2; eye++) {
+        recordTasks.push_back({0, eye, true, 0, 0});
+        for (uint32_t first = 0; first < chunkSlots.size(); first += chunkGroupSize)
+            recordTasks.push_back({translucent ? 1u : 0u, eye, false, first,
+                                   std::min<uint32_t>(chunkGroupSize, chunkSlots.size() - first)});
+    }
+    recordSceneTasks(i);
+
+    std::vector<std::vector<VkCommandBuffer>> subpassBuffers(2);
+    for (size_t task = 0; task < recordTasks.size(); task++)
+        subpassBuffers[recordTasks[task].subpass].push_back(recordResults[task]);
+
+    vkBeginCommandBuffer(commandBuffers[i], &beginInfo);
+    if (timestampsSupported) {
+        vkCmdResetQueryPool(commandBuffers[i], timestampPool, eyeTimestamps * i, eyeTimestamps);
+        vkCmdWriteTimestamp(commandBuffers[i], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampPool, eyeTimestamps * i);
+    }
+    if (densityUploadPending)
+        copyDensityMap(commandBuffers[i], i);
+    if (translucent && fragmentListsEnabled)
+        clearFragmentLists(commandBuffers[i]);
+
+    // Ranges released by the async queues are acquired before the first draw reads them
+    std::vector<VkBufferMemoryBarrier> acquires = uploadReleases;
+    if (occlusionPending && computeFamily != graphicsFamily)
+        acquires.push_back(ownershipBarrier(occlusionBuffer, 0, VK_WHOLE_SIZE, computeFamily, graphicsFamily));
+    for (auto &barrier : acquires) {
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+                VK_ACCESS_SHADER_READ_BIT;
+    }
+    if (!acquires.empty())
+        vkCmdPipelineBarrier(commandBuffers[i], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                             VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, 0, nullptr,
+                             acquires.size(), acquires.data(), 0, nullptr);
+    vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+    vkCmdExecuteCommands(commandBuffers[i], subpassBuffers[0].size(), subpassBuffers[0].data());
+    vkCmdNextSubpass(commandBuffers[i], VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+    if (!subpassBuffers[1].empty())
+        vkCmdExecuteCommands(commandBuffers[i], subpassBuffers[1].size(), subpassBuffers[1].data());
+    vkCmdNextSubpass(commandBuffers[i], VK_SUBPASS_CONTENTS_INLINE);
+    if (translucent) {
+        vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout,
+                                0, 1, &descriptorSets[i], 0, nullptr);
+        vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, compositePipeline);
+        vkCmdSetViewport(commandBuffers[i], 0, 1, &compositeViewport);
+        vkCmdSetScissor(commandBuffers[i], 0, 1, &renderPassInfo.renderArea);
+        vkCmdDraw(commandBuffers[i], 3, 1, 0, 0);
+    }
+
+    vkCmdEndRenderPass(commandBuffers[i]);
+    if (timestampsSupported)
+        vkCmdWriteTimestamp(commandBuffers[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampPool,
+                            eyeTimestamps * i + 1);
+    if (ssaoEnabled)
+        recordScreenOcclusion(commandBuffers[i], i);
+    if (timestampsSupported)
+        vkCmdWriteTimestamp(commandBuffers[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampPool,
+                            eyeTimestamps * i + 2);
+    vkEndCommandBuffer(commandBuffers[i]);
+}
+
+void createCommandBuffers() {
+    VkCommandBufferAllocateInfo allocateInfo{};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocateInfo.commandPool = commandPool;
+    allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocateInfo.commandBufferCount = eyeImageCount;
+
+    commandBuffers.resize(eyeImageCount);
+    vkAllocateCommandBuffers(device, &allocateInfo, commandBuffers.data());
+
+    if (timestampsSupported) {
+        VkQueryPoolCreateInfo queryInfo{};
+        queryInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryInfo.queryCount = eyeTimestamps * eyeImageCount;
+
+        vkCreateQueryPool(device, &queryInfo, nullptr, &timestampPool);
+    }
+
+    eyeScales.assign(eyeImageCount, renderScale);
+    timestampsWritten.assign(eyeImageCount, false);
+    eyePoseTimes.assign(eyeImageCount, 0);
+
+    // Half the cores are assumed to be the big ones, the render thread counts as the first worker
+    uint32_t workerCount = glm::clamp(std::thread::hardware_concurrency() / 2, 1u, recordWorkerLimit);
+    recordWorkers.resize(workerCount);
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = graphicsFamily;
+
+    for (auto &worker : recordWorkers) {
+        worker.pools.resize(eyeImageCount);
+        worker.buffers.resize(eyeImageCount);
+        for (auto &pool : worker.pools)
+            vkCreateCommandPool(device, &poolInfo, nullptr, &pool);
+    }
+
+    recordRunning = true;
+    for (uint32_t worker = 1; worker < workerCount; worker++)
+        recordWorkers[worker].thread = std::thread(runRecorder, worker);
+}
+
+void loadViewerProfile() {
+    viewerProfile = {0.34f, 0.55f, 0.994f, 1.006f, 0.0f};
+
+    if (!app->activity->externalDataPath)
+        return;
+
+    std::ifstream file(std::string(app->activity->externalDataPath) + "/viewer.txt");
+    std::string name;
+    float value;
+
+    while (file >> name >> value) {
+        if (name == "k1")
+            viewerProfile.k1 = value;
+        else if (name == "k2")
+            viewerProfile.k2 = value;
+        else if (name == "red")
+            viewerProfile.redScale = value;
+        else if (name == "blue")
+            viewerProfile.blueScale = value;
+        else if (name == "lens")
+            viewerProfile.lensOffset = value;
+    }
+}
+
+// Each eye gets a grid over its half of the screen, vertices carry where each colour channel is read from
+void createDistortionMesh() {
+    loadViewerProfile();
+
+    uint32_t rowLength = distortionResolution + 1;
+    distortionVertexCount = rowLength * rowLength;
+    distortionIndexCount = distortionResolution * distortionResolution * 6;
+
+    float tangent = glm::tan(glm::radians(45.0f) / 2.0f);
+    glm::vec2 tangentScale(tangent * (swapchainExtent.width / 2.0f) / swapchainExtent.height, tangent);
+
+    std::vector<DistortionVertex> vertices;
+    for (uint32_t eye = 0; eye < 2; eye++) {
+        glm::vec2 lensCenter(eye ? -viewerProfile.lensOffset : viewerProfile.lensOffset, 0.0f);
+
+        for (uint32_t row = 0; row < rowLength; row++) {
+            for (uint32_t column = 0; column < rowLength; column++) {
+                glm::vec2 screen = glm::vec2(column, row) / (float) distortionResolution;
+                glm::vec2 lens = screen * 2.0f - 1.0f - lensCenter;
+                float radius = glm::dot(lens * tangentScale, lens * tangentScale);
+                glm::vec2 source = lens * (1.0f + viewerProfile.k1 * radius +
+                        viewerProfile.k2 * radius * radius);
+
+                DistortionVertex vertex{};
+                vertex.position = glm::vec2(screen.x + eye - 1.0f, screen.y * 2.0f - 1.0f);
+                vertex.red = source * viewerProfile.redScale;
+                vertex.green = source;
+                vertex.blue = source * viewerProfile.blueScale;
+                vertices.push_back(vertex);
+            }
+        }
+    }
+
+    std::vector<uint16_t> indices;
+    for (uint32_t row = 0; row < distortionResolution; row++) {
+        for (uint32_t column = 0; column < distortionResolution; column++) {
+            uint16_t corner = row * rowLength + column;
+            indices.insert(indices.end(), {corner, (uint16_t) (corner + 1), (uint16_t) (corner + rowLength),
+                                           (uint16_t) (corner + 1), (uint16_t) (corner + rowLength + 1),
+                                           (uint16_t) (corner + rowLength)});
+        }
+    }
+
+    createDeviceBuffer(vertices.data(), sizeof(DistortionVertex) * vertices.size(),
+                       VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, distortionVertexBuffer, distortionVertexMemory);
+    createDeviceBuffer(indices.data(), sizeof(uint16_t) * indices.size(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                       distortionIndexBuffer, distortionIndexMemory);
+}
+
+void createWarpBuffers() {
+    warpBuffers.resize(imageCount);
+    warpMemories.resize(imageCount);
+    warpMappings.resize(imageCount);
+
+    for (size_t i = 0; i < imageCount; i++) {
+        createBuffer(sizeof(WarpTransform), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                     warpBuffers[i], warpMemories[i]);
+        vkMapMemory(device, warpMemories[i], 0, sizeof(WarpTransform), 0, &warpMappings[i]);
+    }
+}
+
+// One set per swapchain image and eye image pair, so warp command buffers can be recorded once
+void createWarpDescriptorSets() {
+    uint32_t setCount = imageCount * eyeImageCount;
+
+    std::vector<VkDescriptorPoolSize> poolSizes(2);
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    poolSizes[0].descriptorCount = setCount;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSizes[1].descriptorCount = 3 * setCount;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = poolSizes.size();
+    poolInfo.pPoolSizes = poolSizes.data();
+    poolInfo.maxSets = setCount;
+
+    vkCreateDescriptorPool(device, &poolInfo, nullptr, &warpDescriptorPool);
+
+    std::vector<VkDescriptorSetLayout> layouts(setCount, warpDescriptorSetLayout);
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = warpDescriptorPool;
+    allocInfo.descriptorSetCount = setCount;
+    allocInfo.pSetLayouts = layouts.data();
+
+    warpDescriptorSets.resize(setCount);
+    vkAllocateDescriptorSets(device, &allocInfo, warpDescriptorSets.data());
+
+    for (size_t i = 0; i < setCount; i++) {
+        size_t image = i / eyeImageCount, eye = i % eyeImageCount;
+
+        VkDescriptorBufferInfo bufferInfo{};
+        bufferInfo.buffer = warpBuffers[image];
+        bufferInfo.offset = 0;
+        bufferInfo.range = sizeof(WarpTransform);
+
+        VkDescriptorImageInfo colorInfo{};
+        colorInfo.sampler = eyeSampler;
+        colorInfo.imageView = eyeColorViews[eye];
+        colorInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+        VkDescriptorImageInfo depthInfo{};
+        depthInfo.sampler = eyeSampler;
+        depthInfo.imageView = eyeDepthViews[eye];
+        depthInfo.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+        VkDescriptorImageInfo occlusionInfo{};
+        occlusionInfo.sampler = eyeSampler;
+        occlusionInfo.imageView = eyeOcclusionViews[eye];
+        occlusionInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        std::vector<VkWriteDescriptorSet> descriptorWrites(4);
+        descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[0].dstSet = warpDescriptorSets[i];
+        descriptorWrites[0].dstBinding = 0;
+        descriptorWrites[0].dstArrayElement = 0;
+        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        descriptorWrites[0].descriptorCount = 1;
+        descriptorWrites[0].pBufferInfo = &bufferInfo;
+
+        descriptorWrites[1] = descriptorWrites[0];
+        descriptorWrites[1].dstBinding = 1;
+        descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWrites[1].pBufferInfo = nullptr;
+        descriptorWrites[1].pImageInfo = &colorInfo;
+
+        descriptorWrites[2] = descriptorWrites[1];
+        descriptorWrites[2].dstBinding = 2;
+        descriptorWrites[2].pImageInfo = &depthInfo;
+
+        descriptorWrites[3] = descriptorWrites[1];
+        descriptorWrites[3].dstBinding = 3;
+        descriptorWrites[3].pImageInfo = &occlusionInfo;
+
+        vkUpdateDescriptorSets(device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+    }
+}
+
+void createWarpCommandBuffers() {
+    uint32_t bufferCount = imageCount * eyeImageCount;
+
+    VkCommandBufferAllocateInfo allocateInfo{};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocateInfo.commandPool = commandPool;
+    allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocateInfo.commandBufferCount = bufferCount;
+
+    warpCommandBuffers.resize(bufferCount);
+    vkAllocateCommandBuffers(device, &allocateInfo, warpCommandBuffers.data());
+
+    if (calibratedTimestampsSupported) {
+        VkQueryPoolCreateInfo queryInfo{};
+        queryInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryInfo.queryCount = imageCount;
+
+        vkCreateQueryPool(device, &queryInfo, nullptr, &warpTimestampPool);
+    }
+
+    imageFrames.assign(imageCount, 0);
+
+    for (size_t i = 0; i < bufferCount; i++) {
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+        VkRenderPassBeginInfo renderPassInfo{};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassInfo.renderPass = warpRenderPass;
+        renderPassInfo.framebuffer = warpFramebuffers[i / eyeImageCount];
+        renderPassInfo.renderArea.offset = {0, 0};
+        renderPassInfo.renderArea.extent = swapchainExtent;
+
+        VkDeviceSize offset = 0;
+
+        vkBeginCommandBuffer(warpCommandBuffers[i], &beginInfo);
+        if (calibratedTimestampsSupported)
+            vkCmdResetQueryPool(warpCommandBuffers[i], warpTimestampPool, i / eyeImageCount, 1);
+        vkCmdBeginRenderPass(warpCommandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+        vkCmdBindPipeline(warpCommandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, warpPipeline);
+        vkCmdBindDescriptorSets(warpCommandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                warpPipelineLayout, 0, 1, &warpDescriptorSets[i], 0, nullptr);
+        vkCmdBindVertexBuffers(warpCommandBuffers[i], 0, 1, &distortionVertexBuffer, &offset);
+        vkCmdBindIndexBuffer(warpCommandBuffers[i], distortionIndexBuffer, 0, VK_INDEX_TYPE_UINT16);
+
+        // The instance index tells the shaders which eye the mesh belongs to
+        for (uint32_t eye = 0; eye < 2; eye++)
+            vkCmdDrawIndexed(warpCommandBuffers[i], distortionIndexCount, 1, 0, eye * distortionVertexCount,
+                             eye);
+        vkCmdEndRenderPass(warpCommandBuffers[i]);
+        if (calibratedTimestampsSupported)
+            vkCmdWriteTimestamp(warpCommandBuffers[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, warpTimestampPool,
+                                i / eyeImageCount);
+        vkEndCommandBuffer(warpCommandBuffers[i]);
+    }
+}
+
+void createSyncObject() {
+    currentFrame = 0;
+
+    imageValues.assign(imageCount, 0);
+    acquireSemaphores.resize(framesInFlight);
+    presentSemaphores.resize(imageCount);
+
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    for (size_t i = 0; i < framesInFlight; i++)
+        vkCreateSemaphore(device, &semaphoreInfo, nullptr, &acquireSemaphores[i]);
+    for (size_t i = 0; i < imageCount; i++)
+        vkCreateSemaphore(device, &semaphoreInfo, nullptr, &presentSemaphores[i]);
+
+    sceneIndex = 0;
+    displayedEye = 0;
+    sceneSubmitted = false;
+    eyeReady = false;
+
+    sceneValues.assign(eyeImageCount, 0);
+    eyeReleaseValues.assign(eyeImageCount, 0);
+    eyeViews.assign(2 * eyeImageCount, glm::mat4(1.0f));
+}
+
+void clearInstance() {
+    vkDestroySurfaceKHR(instance, surface, nullptr);
+    auto destroyDebugUtilsMessenger = (PFN_vkDestroyDebugUtilsMessengerEXT)
+            vkGetInstanceProcAddr(instance, "vkDestroyDebugUtilsMessengerEXT");
+    destroyDebugUtilsMessenger(instance, messenger, nullptr);
+    vkDestroyInstance(instance, nullptr);
+}
+
+bool setup() {
+    loadSettings();
+    initialize();
+    if (!pickDevice()) {
+        clearInstance();
+        return false;
+    }
+    chooseQuality();
+    createSwapchain();
     createRenderPass();
+    createWarpRenderPass();
     createPipeline();
+    createWarpPipeline();
     createColorBuffer();
-    createDepthBuffer();
+    createEyeImages();
+    createDensityMaps();
     createFramebuffers();
+    createPaletteBuffer();
+    loadStructure();
     createVertexBuffer();
     createIndexBuffer();
+    createOcclusionBuffer();
+    createChunkBuffers();
+    createInstanceBuffers();
+    createIndirectBuffers();
+    createTrajectoryBuffers();
+    createUploadCommandBuffers();
     createUniformBuffers();
     createDescriptorPool();
     createDescriptorSets();
+    createScreenOcclusion();
     createCommandBuffers();
+    createWarpBuffers();
+    createDistortionMesh();
+    createWarpDescriptorSets();
+    createWarpCommandBuffers();
     createSyncObject();
+    return true;
 }
 
-void updateUniformBuffer(uint32_t imageIndex) {
-    static ASensorEvent event{};
-    static glm::mat4 rotation(1.0f);
-    static const float margin = 0.08f;
+void readSensors() {
+    SensorRecord record{};
 
-    while (ASensorEventQueue_hasEvents(sensorQueue) == 1) {
-        ASensorEventQueue_getEvents(sensorQueue, &event, 1);
-        rotation = glm::rotate(rotation, -event.vector.y / 120.0f, glm::vec3(1.0f, 0.0f, 0.0f));
-        rotation = glm::rotate(rotation, -event.vector.z / 120.0f, glm::vec3(0.0f, 1.0f, 0.0f));
-        rotation = glm::rotate(rotation, event.vector.x / 120.0f, glm::vec3(0.0f, 0.0f, 1.0f));
+    while (popSensorRecord(sensorRecords, record)) {
+        updateTracker(tracker, record);
+        if (record.type == SENSOR_GYROSCOPE)
+            updatePredictor(predictor, tracker);
+        if (sensorLog.is_open())
+            writeSensorRecord(sensorLog, record);
     }
+}
+
+uint64_t steadyNanoseconds() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+glm::mat4 predictRotation() {
+    timespec bootTime{};
+    clock_gettime(CLOCK_BOOTTIME, &bootTime);
+    int64_t sensorAge = bootTime.tv_sec * 1000000000ll + bootTime.tv_nsec - tracker.timestamp;
+    float horizon = glm::max(sensorAge, (int64_t) 0) * 1e-9f + presentLatency;
+
+    poseTime = steadyNanoseconds();
+    sensorTime = tracker.initialized ? poseTime - glm::max(sensorAge, (int64_t) 0) : 0;
+    return glm::mat4_cast(predictOrientation(tracker, predictor, horizon));
+}
+
+void eyeLookAt(const glm::mat4 &rotation, glm::mat4 &left, glm::mat4 &right) {
+    static const float margin = 0.08f;
 
     glm::vec3 center(0.0f, 0.0f, 0.0f);
     glm::vec3 forward = rotation * glm::vec4(0.0f, 1.0f, 0.0f, 0.0f);
-    glm::vec3 left = rotation * glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+    glm::vec3 side = rotation * glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
     glm::vec3 up = rotation * glm::vec4(0.0f, 0.0f, 1.0f, 0.0f);
 
-    static auto startTime = std::chrono::high_resolution_clock::now();
-    auto currentTime = std::chrono::high_resolution_clock::now();
-    float time = std::chrono::duration<float, std::chrono::seconds::period>(
-            currentTime - startTime).count();
+    left = glm::lookAt(center + margin * side, center + forward, up);
+    right = glm::lookAt(center - margin * side, center + forward, up);
+}
+
+// Culling and streaming only need a rough pose, the one drawn with is latched later
+void updateCulling() {
+    readSensors();
+    glm::mat4 rotation = predictRotation();
+    cullPoseTime = poseTime;
+
+    glm::mat4 left, right;
+    eyeLookAt(rotation, left, right);
+    cullMatrices[0] = eyeProjectionMatrix(cullAngle) * left;
+    cullMatrices[1] = eyeProjectionMatrix(cullAngle) * right;
+}
+
+void updateUniformBuffer(uint32_t eyeIndex) {
+    readSensors();
+    glm::mat4 rotation = predictRotation();
 
     Transform transform{};
     transform.model = glm::mat4(1.0f);
-    transform.left = glm::lookAt(center + margin * left, center + forward, up);
-    transform.right = glm::lookAt(center - margin * left, center + forward, up);
-    transform.proj = glm::perspective(glm::radians(45.0f),
-                                      (swapchainExtent.width / 2.0f) / swapchainExtent.height, 0.1f,
-                                      10.0f);
-    transform.proj[1][1] *= -1;
+    eyeLookAt(rotation, transform.left, transform.right);
+    transform.proj = eyeProjectionMatrix();
+    transform.playback = glm::uvec4(previousSlot, vertexData.size() / atomVertices, positionSlot, keyframeLoaded);
+    transform.keyframe = glm::vec4(keyframeTime, 0.0f, 0.0f, 0.0f);
 
-    void *data;
-    vkMapMemory(device, uniformMemories[imageIndex], 0, sizeof(Transform), 0, &data);
-    memcpy(data, &transform, sizeof(Transform));
-    vkUnmapMemory(device, uniformMemories[imageIndex]);
+    eyeViews[2 * eyeIndex] = transform.left;
+    eyeViews[2 * eyeIndex + 1] = transform.right;
+    eyePoseTimes[eyeIndex] = poseTime;
+    eyeProjection = transform.proj;
+
+    memcpy(uniformMappings[eyeIndex], &transform, sizeof(Transform));
 }
 
-void draw() {
-    vkWaitForFences(device, 1, &frameFences[currentImage], VK_TRUE, UINT64_MAX);
+// Maps output clip space under the newest pose back into the eye image rendered under an older one
+void updateWarpBuffer(uint32_t imageIndex) {
+    readSensors();
+    glm::mat4 rotation = predictRotation();
 
-    uint32_t imageIndex;
-    vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, availableSemaphores[currentImage],
-                          VK_NULL_HANDLE, &imageIndex);
+    glm::mat4 views[2];
+    eyeLookAt(rotation, views[0], views[1]);
 
-    if (orderFences[imageIndex] != VK_NULL_HANDLE)
-        vkWaitForFences(device, 1, &orderFences[imageIndex], VK_TRUE, UINT64_MAX);
+    WarpTransform warp{};
+    warp.resolution = glm::vec4(eyeScales[displayedEye], ssaoEnabled ? 1.0f : 0.0f, 0.0f, 0.0f);
+    warp.foveation = glm::vec4(foveaExtent, peripheryDensity, foveaExtent + (1.0f - foveaExtent) * peripheryDensity,
+                               multiResolution ? 1.0f : 0.0f);
+    glm::mat4 inverseProjection = glm::inverse(eyeProjection);
+    for (uint32_t side = 0; side < 2; side++)
+        warp.reprojection[side] = eyeProjection * eyeViews[2 * displayedEye + side] *
+                glm::inverse(views[side]) * inverseProjection;
 
-    orderFences[imageIndex] = frameFences[currentImage];
+    memcpy(warpMappings[imageIndex], &warp, sizeof(WarpTransform));
+}
 
-    std::vector<VkSemaphore> waitSemaphores{availableSemaphores[currentImage]};
-    std::vector<VkSemaphore> signalSemaphores{finishedSemaphores[currentImage]};
-    std::vector<VkPipelineStageFlags> waitStages{VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+VkCommandBuffer beginUploadCommand(uint32_t frameIndex) {
+    VkCommandBuffer commandBuffer = uploadCommandBuffers[frameIndex];
+    if (uploadRecording)
+        return commandBuffer;
 
-    updateUniformBuffer(currentImage);
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
-    VkSubmitInfo submitInfo{};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.waitSemaphoreCount = waitSemaphores.size();
-    submitInfo.pWaitSemaphores = waitSemaphores.data();
-    submitInfo.pWaitDstStageMask = waitStages.data();
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
-    submitInfo.signalSemaphoreCount = signalSemaphores.size();
-    submitInfo.pSignalSemaphores = signalSemaphores.data();
+    // Scene passes never overlap on the CPU side, so only a shared queue needs to order against the last one
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    if (transferFamily == graphicsFamily)
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+    uploadRecording = true;
+    return commandBuffer;
+}
+
+// Only the copied ranges change owner, the rest of the buffer stays with the graphics family
+void uploadBuffer(uint32_t frameIndex, VkBuffer source, VkBuffer destination, const VkBufferCopy &region) {
+    vkCmdCopyBuffer(beginUploadCommand(frameIndex), source, destination, 1, &region);
+
+    if (transferFamily != graphicsFamily) {
+        uploadReleases.push_back(ownershipBarrier(destination, region.dstOffset, region.size, transferFamily,
+                                                  graphicsFamily));
+        uploadReleases.back().srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    }
+}
+
+void endUploadCommand(uint32_t frameIndex) {
+    if (transferFamily != graphicsFamily) {
+        vkCmdPipelineBarrier(uploadCommandBuffers[frameIndex], VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, uploadReleases.size(),
+                             uploadReleases.data(), 0, nullptr);
+        vkEndCommandBuffer(uploadCommandBuffers[frameIndex]);
+        return;
+    }
+
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+            VK_ACCESS_SHADER_READ_BIT;
+
+    vkCmdPipelineBarrier(uploadCommandBuffers[frameIndex], VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0,
+                         1, &barrier, 0, nullptr, 0, nullptr);
+    vkEndCommandBuffer(uploadCommandBuffers[frameIndex]);
+}
+
+void seekTrajectory(uint32_t frame) {
+    if (!trajectoryLoaded)
+        return;
+
+    seekPlayer(player, frame);
+    keyframeTime = 1.0f;
+    playbackTime = std::chrono::steady_clock::now();
+}
+
+void updatePlayback(uint32_t frameIndex) {
+    if (!trajectoryLoaded)
+        return;
+
+    float position = seekPosition.exchange(-1.0f);
+    if (position >= 0.0f)
+        seekTrajectory((uint32_t) glm::round(position * (player.file.frameOffsets.size() - 1)));
+
+    if (trajectoryReleases[frameIndex] >= 0) {
+        releaseFrame(player, trajectoryReleases[frameIndex]);
+        trajectoryReleases[frameIndex] = -1;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    float elapsed = std::chrono::duration<float, std::chrono::seconds::period>(now - playbackTime).count();
+    playbackTime = now;
+
+    keyframeTime += glm::min(elapsed, 0.1f) * trajectoryKeyframeRate;
+    if (keyframeTime < 1.0f)
+        return;
+
+    TrajectoryFrame frame{};
+    if (!acquireFrame(player, frame)) {
+        keyframeTime = 1.0f;
+        return;
+    }
+    keyframeTime = glm::min(keyframeTime - 1.0f, 1.0f);
+
+    VkDeviceSize frameSize = sizeof(float) * 3 * player.file.atomCount;
+    uint32_t target = positionSlot % positionSlotCount + 1;
+    VkBufferCopy region{0, target * frameSize, frameSize};
+
+    uploadBuffer(frameIndex, trajectoryStagingBuffers[frame.slot], positionBuffer, region);
+
+    // Loop restarts and seeks snap to the new keyframe instead of blending across the jump
+    bool consecutive = keyframeLoaded && frame.frame == keyframeNumber + 1;
+    previousSlot = consecutive ? positionSlot : target;
+    positionSlot = target;
+    keyframeNumber = frame.frame;
+    keyframeLoaded = true;
+    trajectoryReleases[frameIndex] = frame.slot;
+
+    glm::vec3 minimum(FLT_MAX), maximum(-FLT_MAX);
+    const float *positions = player.slots[frame.slot];
+    for (uint32_t i = 0; i < player.file.atomCount; i++) {
+        glm::vec3 position(positions[3 * i], positions[3 * i + 1], positions[3 * i + 2]);
+        minimum = glm::min(minimum, position);
+        maximum = glm::max(maximum, position);
+    }
+
+    glm::vec3 blendMinimum = consecutive ? glm::min(minimum, keyframeMinimum) : minimum;
+    glm::vec3 blendMaximum = consecutive ? glm::max(maximum, keyframeMaximum) : maximum;
+    assemblyCenter = (blendMinimum + blendMaximum) / 2.0f;
+    assemblyRadius = glm::length(blendMaximum - assemblyCenter);
+
+    keyframeMinimum = minimum;
+    keyframeMaximum = maximum;
+}
+
+void updateInstances(uint32_t imageIndex) {
+    glm::vec4 planes[2][6];
+    extractEyeFrusta(planes);
+
+    auto instances = (glm::mat4 *) instanceMappings[imageIndex];
+    visibleOperators.clear();
+
+    for (auto &matrix : assemblyOperators) {
+        glm::vec3 center = matrix * glm::vec4(assemblyCenter, 1.0f);
+        float radius = assemblyRadius * operatorScale(matrix);
 
-    vkResetFences(device, 1, &frameFences[currentImage]);
-    vkQueueSubmit(queue, 1, &submitInfo, frameFences[currentImage]);
+        if (intersectsSphere(planes[0], center, radius) || intersectsSphere(planes[1], center, radius)) {
+            instances[visibleOperators.size()] = matrix;
+            visibleOperators.push_back(matrix);
+        }
+    }
+
+    // Streamed structures draw the same instances through the chunk slots instead
+    auto command = (VkDrawIndexedIndirectCommand *) indirectMappings[imageIndex];
+    command->indexCount = structureStreamed ? 0 : indexData.size();
+    command->instanceCount = visibleOperators.size();
+    command->firstIndex = 0;
+    command->vertexOffset = 0;
+    command->firstInstance = 0;
+}
+
+void updateResidency(uint32_t frameIndex, uint32_t imageIndex) {
+    if (chunkSlots.empty())
+        return;
+
+    glm::vec4 planes[2][6];
+    extractEyeFrusta(planes);
+
+    // Chunks hold the asymmetric unit, so the frusta are moved into the space of every visible operator instead
+    std::vector<glm::vec4> placedPlanes(visibleOperators.size() * 12);
+    for (size_t i = 0; i < visibleOperators.size(); i++)
+        for (uint32_t plane = 0; plane < 12; plane++)
+            placedPlanes[i * 12 + plane] = glm::transpose(visibleOperators[i]) * planes[plane / 6][plane % 6];
+
+    auto placedVisible = [&placedPlanes](const Chunk &chunk) {
+        for (size_t i = 0; i < placedPlanes.size(); i += 6)
+            if (intersectsFrustum(&placedPlanes[i], chunk.minimum, chunk.maximum, 0.0f))
+                return true;
+        return false;
+    };
+
+    // Tracking is rotation only, so the eyes never leave the origin and distances are measured from it
+    std::vector<uint32_t> order(chunks.size());
+    for (uint32_t i = 0; i < chunks.size(); i++) {
+        auto &chunk = chunks[i];
+        glm::vec3 center = (chunk.minimum + chunk.maximum) / 2.0f;
+        float radius = glm::length(chunk.maximum - center);
+        float distance = FLT_MAX;
+        for (auto &matrix : assemblyOperators)
+            distance = glm::min(distance, glm::max(glm::length(glm::vec3(matrix * glm::vec4(center, 1.0f))) -
+                                                   radius * operatorScale(matrix), 0.0f));
+
+        if (distance > chunkStreamDistance)
+            chunk.priority = FLT_MAX;
+        else if (placedVisible(chunk))
+            chunk.priority = distance;
+        else
+            chunk.priority = chunkStreamDistance + distance;
+
+        order[i] = i;
+    }
+
+    std::sort(order.begin(), order.end(), [](uint32_t first, uint32_t second) {
+        return chunks[first].priority < chunks[second].priority;
+    });
+
+    std::vector<bool> wanted(chunks.size(), false);
+    for (size_t i = 0; i < chunkSlots.size() && chunks[order[i]].priority < FLT_MAX; i++)
+        wanted[order[i]] = true;
+
+    {
+        std::lock_guard<std::mutex> lock(streamMutex);
+        for (auto request : streamRequests)
+            chunks[request].pending = false;
+        streamRequests.clear();
+
+        for (size_t i = 0; i < chunkSlots.size() && streamRequests.size() < chunkRequestLimit; i++) {
+            auto &chunk = chunks[order[i]];
+            if (wanted[order[i]] && chunk.slot < 0 && !chunk.pending) {
+                chunk.pending = true;
+                streamRequests.push_back(order[i]);
+            }
+        }
+
+        while (!streamResults.empty()) {
+            chunkUploads.push_back(std::move(streamResults.front()));
+            streamResults.pop_front();
+        }
+    }
+    streamCondition.notify_one();
+
+    VkDeviceSize stagingOffset = 0;
+
+    while (!chunkUploads.empty()) {
+        auto &data = chunkUploads.front();
+        auto &chunk = chunks[data.chunk];
+        VkDeviceSize vertexSize = data.vertices.size();
+        VkDeviceSize indexSize = sizeof(uint16_t) * data.indices.size();
+        VkDeviceSize occlusionSize = sizeof(uint8_t) * data.occlusion.size();
+
+        if (!wanted[data.chunk] || chunk.slot >= 0 || data.vertices.empty()) {
+            chunk.pending = false;
+            chunkUploads.pop_front();
+            continue;
+        }
+
+        if (stagingOffset + vertexSize + indexSize + occlusionSize > chunkUploadBudget)
+            break;
+
+        int32_t slot = -1;
+        for (size_t i = 0; i < chunkSlots.size(); i++) {
+            if (chunkSlots[i] < 0) {
+                slot = i;
+                break;
+            }
+            if (!wanted[chunkSlots[i]] && (slot < 0 ||
+                    chunks[chunkSlots[i]].priority > chunks[chunkSlots[slot]].priority))
+                slot = i;
+        }
+
+        chunk.pending = false;
+        if (slot < 0) {
+            chunkUploads.pop_front();
+            continue;
+        }
+
+        if (chunkSlots[slot] >= 0)
+            chunks[chunkSlots[slot]].slot = -1;
+        chunkSlots[slot] = data.chunk;
+        chunk.slot = slot;
+
+        auto staging = (char *) chunkStagingMappings[frameIndex];
+        memcpy(staging + stagingOffset, data.vertices.data(), vertexSize);
+        memcpy(staging + stagingOffset + vertexSize, data.indices.data(), indexSize);
+        memcpy(staging + stagingOffset + vertexSize + indexSize, data.occlusion.data(), occlusionSize);
+
+        VkBufferCopy vertexRegion{stagingOffset, slot * chunkMaxVertices * chunkLayout.stride, vertexSize};
+        VkBufferCopy indexRegion{stagingOffset + vertexSize,
+                                 slot * chunkMaxIndices * sizeof(uint16_t), indexSize};
+        VkBufferCopy occlusionRegion{stagingOffset + vertexSize + indexSize,
+                                     slot * chunkMaxVertices * sizeof(uint8_t), occlusionSize};
+
+        uploadBuffer(frameIndex, chunkStagingBuffers[frameIndex], chunkVertexBuffer, vertexRegion);
+        uploadBuffer(frameIndex, chunkStagingBuffers[frameIndex], chunkIndexBuffer, indexRegion);
+        uploadBuffer(frameIndex, chunkStagingBuffers[frameIndex], chunkOcclusionBuffer, occlusionRegion);
+
+        stagingOffset += vertexSize + indexSize + occlusionSize;
+        chunkUploads.pop_front();
+    }
+
+    auto commands = (VkDrawIndexedIndirectCommand *) indirectMappings[imageIndex] + 1;
+    for (size_t slot = 0; slot < chunkSlots.size(); slot++) {
+        bool visible = chunkSlots[slot] >= 0 && placedVisible(chunks[chunkSlots[slot]]);
+
+        commands[slot].indexCount = visible ? chunks[chunkSlots[slot]].indexCount : 0;
+        commands[slot].instanceCount = visibleOperators.size();
+        commands[slot].firstIndex = slot * chunkMaxIndices;
+        commands[slot].vertexOffset = slot * chunkMaxVertices;
+        commands[slot].firstInstance = 0;
+    }
+
+}
+
+void writeLatency(const FrameTiming &timing) {
+    if (!latencyLog.is_open())
+        return;
+
+    writeFrameTiming(latencyLog, timing);
+    latencyHistory.push_back(timing);
+
+    if (latencyHistory.size() >= latencySummaryFrames) {
+        writeLatencySummary(latencyLog, latencyHistory);
+        latencyHistory.clear();
+    }
+}
+
+// The warp of the frame last shown from this image has finished once the image is handed out again
+void updateWarpTime(uint32_t imageIndex) {
+    uint64_t timestamp;
+
+    if (!calibratedTimestampsSupported || !imageFrames[imageIndex] ||
+            vkGetQueryPoolResults(device, warpTimestampPool, imageIndex, 1, sizeof(timestamp), &timestamp,
+                                  sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+        return;
+
+    VkCalibratedTimestampInfoEXT calibrationInfos[2]{};
+    calibrationInfos[0].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+    calibrationInfos[0].timeDomain = VK_TIME_DOMAIN_DEVICE_EXT;
+    calibrationInfos[1].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+    calibrationInfos[1].timeDomain = VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT;
+
+    uint64_t calibration[2], deviation;
+    if (getCalibratedTimestamps(device, 2, calibrationInfos, calibration, &deviation) != VK_SUCCESS)
+        return;
+
+    for (auto &frame : presentFrames)
+        if (frame.frame == imageFrames[imageIndex])
+            frame.gpuTime = (int64_t) calibration[1] -
+                            (int64_t) ((calibration[0] - timestamp) * timestampPeriod);
+}
+
+void updatePresentLatency() {
+    if (displayTimingSupported) {
+        uint32_t timingCount = 0;
+        getPastPresentationTiming(device, swapchain, &timingCount, nullptr);
+        std::vector<VkPastPresentationTimingGOOGLE> timings(timingCount);
+        if (timingCount)
+            getPastPresentationTiming(device, swapchain, &timingCount, timings.data());
+
+        for (auto &timing : timings) {
+            auto frame = std::find_if(presentFrames.begin(), presentFrames.end(),
+                                      [&timing](const FrameTiming &frame) {
+                                          return frame.frame == timing.presentID;
+                                      });
+            if (frame == presentFrames.end())
+                continue;
+
+            // Pose read to first photon, the horizon the predictor has to cover on top of sensor age
+            frame->presentTime = timing.actualPresentTime;
+            float latency = (frame->presentTime - frame->poseTime) * 1e-9f;
+            if (latency > 0.0f && latency < predictor.maximumHorizon)
+                presentLatency = glm::mix(presentLatency, latency, 0.1f);
+        }
+    }
+
+    // Frames are reported once every stage this device can measure is in, or when feedback never comes
+    while (!presentFrames.empty()) {
+        FrameTiming &frame = presentFrames.front();
+        bool complete = (frame.presentTime || !displayTimingSupported) &&
+                        (frame.gpuTime || !calibratedTimestampsSupported);
+        if (!complete && presentFrames.size() <= 2 * imageCount + 8)
+            break;
+
+        updatePacer(pacer, frame);
+        writeLatency(frame);
+        presentFrames.pop_front();
+    }
+}
+
+void updateRenderScale(uint32_t eye) {
+    uint64_t timestamps[eyeTimestamps];
+
+    if (timestampsSupported && timestampsWritten[eye] &&
+            vkGetQueryPoolResults(device, timestampPool, eyeTimestamps * eye, eyeTimestamps, sizeof(timestamps),
+                                  timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+        float elapsed = (timestamps[2] - timestamps[0]) * timestampPeriod * 1e-6f;
+        float occlusion = (timestamps[2] - timestamps[1]) * timestampPeriod * 1e-6f;
+        sceneTime = sceneTime > 0.0f ? glm::mix(sceneTime, elapsed, 0.2f) : elapsed;
+        ssaoTime = ssaoTime > 0.0f ? glm::mix(ssaoTime, occlusion, 0.2f) : occlusion;
+
+        // Shrink straight to the estimated fit, grow one step at a time once well under budget
+        float scale = renderScale;
+        if (sceneTime > sceneTimeBudget)
+            scale = glm::floor(renderScale * glm::sqrt(sceneTimeBudget / sceneTime) / scaleStep) * scaleStep;
+        else if (sceneTime < 0.7f * sceneTimeBudget)
+            scale = glm::round(renderScale / scaleStep + 1.0f) * scaleStep;
+        scale = glm::clamp(scale, minimumScale, 1.0f);
+
+        if (scaleCooldown > 0) {
+            scaleCooldown--;
+        } else if (scale != renderScale) {
+            renderScale = scale;
+            scaleCooldown = 4 * eyeImageCount;
+        }
+    }
+
+    if (eyeScales[eye] == renderScale)
+        return;
+
+    // The copy changes the layout of an attachment, so it is recorded with the scene rather than the uploads
+    if (densityMapSupported) {
+        writeDensityMap((uint8_t *) densityStagingMappings[eye], renderScale);
+        densityUploadPending = true;
+    }
+}
+
+void renderScene() {
+    uint32_t eye = sceneIndex;
+
+    // The eye image may still be sampled by the warp that last displayed it
+    waitTimeline(warpTimeline, eyeReleaseValues[eye]);
+    waitTimeline(sceneTimeline, sceneValues[eye]);
+
+    // The first scene submission waited for the structure bake, every later one finds it finished
+    if (occlusionJob.commandBuffer != VK_NULL_HANDLE && !occlusionPending)
+        releaseComputeJob(occlusionJob);
+
+    uploadRecording = false;
+    densityUploadPending = false;
+    uploadReleases.clear();
+    updateRenderScale(eye);
+    updatePlayback(eye);
+    updateCulling();
+    updateInstances(eye);
+    updateResidency(eye, eye);
+    recordCommandBuffer(eye);
+
+    std::vector<VkCommandBuffer> submitCommandBuffers;
+    std::vector<TimelineWait> waits;
+    VkPipelineStageFlags vertexStages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT;
+
+    if (occlusionPending)
+        waits.push_back({&computeTimeline, VK_NULL_HANDLE, occlusionJob.value, vertexStages});
+
+    // A separate transfer queue copies while the graphics queue may still be busy with the warp
+    if (uploadRecording) {
+        endUploadCommand(eye);
+
+        if (transferFamily != graphicsFamily) {
+            uint64_t uploadValue = submitTimeline(transferQueue, transferTimeline, {uploadCommandBuffers[eye]}, {});
+            waits.push_back({&transferTimeline, VK_NULL_HANDLE, uploadValue, vertexStages});
+        } else {
+            submitCommandBuffers.push_back(uploadCommandBuffers[eye]);
+        }
+    }
+    submitCommandBuffers.push_back(commandBuffers[eye]);
+
+    updateUniformBuffer(eye);
+    latchGain += (poseTime - cullPoseTime) * 1e-6;
+    sceneLatchCount++;
+
+    sceneValues[eye] = submitTimeline(queue, sceneTimeline, submitCommandBuffers, waits);
+    occlusionPending = false;
+    timestampsWritten[eye] = true;
+    latchDelay += (steadyNanoseconds() - poseTime) * 1e-6;
+    latchCount++;
+    sceneSubmitted = true;
+}
+
+void draw() {
+    // Switch to the newest eye image as soon as its scene pass is done, otherwise keep warping the last one
+    if (sceneSubmitted && timelineValue(sceneTimeline) >= sceneValues[sceneIndex]) {
+        displayedEye = sceneIndex;
+        eyeReady = true;
+        sceneSubmitted = false;
+    }
+
+    if (!sceneSubmitted) {
+        sceneIndex = (displayedEye + 1) % eyeImageCount;
+        renderScene();
+    }
+
+    if (!eyeReady) {
+        waitTimeline(sceneTimeline, sceneValues[sceneIndex]);
+        return;
+    }
+
+    // The acquire semaphore of this frame slot was last waited by the warp framesInFlight submissions back
+    if (warpTimeline.value >= framesInFlight)
+        waitTimeline(warpTimeline, warpTimeline.value + 1 - framesInFlight);
+
+    uint32_t imageIndex;
+    vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, acquireSemaphores[currentFrame],
+                          VK_NULL_HANDLE, &imageIndex);
+
+    waitTimeline(warpTimeline, imageValues[imageIndex]);
+    updateWarpTime(imageIndex);
+
+    // Every warp names the scene value of its eye image, a wait that is already met after the first one
+    std::vector<TimelineWait> waits{
+            {nullptr, acquireSemaphores[currentFrame], 0, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT},
+            {&sceneTimeline, VK_NULL_HANDLE, sceneValues[displayedEye], VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT}};
+
+    updateWarpBuffer(imageIndex);
+    imageValues[imageIndex] = submitTimeline(warpQueue, warpTimeline,
+                                             {warpCommandBuffers[imageIndex * eyeImageCount + displayedEye]},
+                                             waits, presentSemaphores[imageIndex]);
+    eyeReleaseValues[displayedEye] = imageValues[imageIndex];
+
+    FrameTiming frame{++presentId};
+    frame.sensorTime = sensorTime;
+    frame.scenePoseTime = eyePoseTimes[displayedEye];
+    frame.poseTime = poseTime;
+    frame.submitTime = steadyNanoseconds();
+    frame.startTime = frameStartTime;
+    frame.deadline = pacer.deadline;
+    presentFrames.push_back(frame);
+    imageFrames[imageIndex] = presentId;
+
+    latchDelay += (frame.submitTime - poseTime) * 1e-6;
+    latchCount++;
 
     VkPresentInfoKHR presentInfo{};
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-    presentInfo.waitSemaphoreCount = signalSemaphores.size();
-    presentInfo.pWaitSemaphores = signalSemaphores.data();
+    presentInfo.waitSemaphoreCount = 1;
+    presentInfo.pWaitSemaphores = &presentSemaphores[imageIndex];
     presentInfo.swapchainCount = 1;
     presentInfo.pSwapchains = &swapchain;
     presentInfo.pImageIndices = &imageIndex;
     presentInfo.pResults = nullptr;
 
-    vkQueuePresentKHR(queue, &presentInfo);
-    currentImage = (currentImage + 1) % imageCount;
+    // Aim half a refresh early so the compositor rounds onto the planned vsync rather than past it
+    VkPresentTimeGOOGLE presentTime{presentId, 0};
+    if (pacer.phaseKnown)
+        presentTime.desiredPresentTime = pacer.deadline - pacer.refreshPeriod / 2;
+    VkPresentTimesInfoGOOGLE presentTimesInfo{};
+    presentTimesInfo.sType = VK_STRUCTURE_TYPE_PRESENT_TIMES_INFO_GOOGLE;
+    presentTimesInfo.swapchainCount = 1;
+    presentTimesInfo.pTimes = &presentTime;
+
+    if (displayTimingSupported)
+        presentInfo.pNext = &presentTimesInfo;
+
+    vkQueuePresentKHR(warpQueue, &presentInfo);
+    updatePresentLatency();
+    currentFrame = (currentFrame + 1) % framesInFlight;
 }
 
 void clear() {
     vkDeviceWaitIdle(device);
+    for (size_t i = 0; i < imageCount; i++)
+        vkDestroySemaphore(device, presentSemaphores[i], nullptr);
+    for (size_t i = 0; i < framesInFlight; i++)
+        vkDestroySemaphore(device, acquireSemaphores[i], nullptr);
+    vkDestroyDescriptorPool(device, warpDescriptorPool, nullptr);
+    vkDestroyBuffer(device, distortionIndexBuffer, nullptr);
+    vkFreeMemory(device, distortionIndexMemory, nullptr);
+    vkDestroyBuffer(device, distortionVertexBuffer, nullptr);
+    vkFreeMemory(device, distortionVertexMemory, nullptr);
     for (size_t i = 0; i < imageCount; i++) {
-        vkDestroySemaphore(device, finishedSemaphores[i], nullptr);
-        vkDestroySemaphore(device, availableSemaphores[i], nullptr);
-        vkDestroyFence(device, frameFences[i], nullptr);
+        vkDestroyBuffer(device, warpBuffers[i], nullptr);
+        vkFreeMemory(device, warpMemories[i], nullptr);
     }
+    if (timestampsSupported)
+        vkDestroyQueryPool(device, timestampPool, nullptr);
+    if (calibratedTimestampsSupported)
+        vkDestroyQueryPool(device, warpTimestampPool, nullptr);
     vkDestroyDescriptorPool(device, descriptorPool, nullptr);
-    for (size_t i = 0; i < imageCount; i++) {
+    for (size_t i = 0; i < eyeImageCount; i++) {
         vkDestroyBuffer(device, uniformBuffers[i], nullptr);
         vkFreeMemory(device, uniformMemories[i], nullptr);
     }
+    if (trajectoryLoaded) {
+        stopPlayer(player);
+        closeTrajectory(player.file);
+        for (uint32_t i = 0; i < trajectorySlotCount; i++) {
+            vkDestroyBuffer(device, trajectoryStagingBuffers[i], nullptr);
+            vkFreeMemory(device, trajectoryStagingMemories[i], nullptr);
+        }
+        trajectoryLoaded = false;
+    }
+    vkDestroyBuffer(device, positionBuffer, nullptr);
+    vkFreeMemory(device, positionMemory, nullptr);
+    for (size_t i = 0; i < eyeImageCount; i++) {
+        vkDestroyBuffer(device, indirectBuffers[i], nullptr);
+        vkFreeMemory(device, indirectMemories[i], nullptr);
+        vkDestroyBuffer(device, instanceBuffers[i], nullptr);
+        vkFreeMemory(device, instanceMemories[i], nullptr);
+    }
+    if (!chunkSlots.empty()) {
+        {
+            std::lock_guard<std::mutex> lock(streamMutex);
+            streamRunning = false;
+        }
+        streamCondition.notify_one();
+        streamThread.join();
+
+        for (size_t i = 0; i < eyeImageCount; i++) {
+            vkDestroyBuffer(device, chunkStagingBuffers[i], nullptr);
+            vkFreeMemory(device, chunkStagingMemories[i], nullptr);
+        }
+        vkDestroyBuffer(device, chunkIndexBuffer, nullptr);
+        vkFreeMemory(device, chunkIndexMemory, nullptr);
+        vkDestroyBuffer(device, chunkVertexBuffer, nullptr);
+        vkFreeMemory(device, chunkVertexMemory, nullptr);
+        vkDestroyBuffer(device, chunkOcclusionBuffer, nullptr);
+        vkFreeMemory(device, chunkOcclusionMemory, nullptr);
+
+        chunkSlots.clear();
+        chunkUploads.clear();
+        streamRequests.clear();
+        streamResults.clear();
+    }
+    vkDestroyBuffer(device, occlusionBuffer, nullptr);
+    vkFreeMemory(device, occlusionMemory, nullptr);
     vkDestroyBuffer(device, indexBuffer, nullptr);
     vkFreeMemory(device, indexMemory, nullptr);
+    vkDestroyBuffer(device, paletteBuffer, nullptr);
+    vkFreeMemory(device, paletteMemory, nullptr);
     vkDestroyBuffer(device, vertexBuffer, nullptr);
     vkFreeMemory(device, vertexMemory, nullptr);
+    for (auto framebuffer : warpFramebuffers)
+        vkDestroyFramebuffer(device, framebuffer, nullptr);
     for (auto framebuffer : framebuffers)
         vkDestroyFramebuffer(device, framebuffer, nullptr);
-    vkDestroyImageView(device, depthView, nullptr);
-    vkDestroyImage(device, depthImage, nullptr);
-    vkFreeMemory(device, depthMemory, nullptr);
+    vkDestroySampler(device, eyeSampler, nullptr);
+    for (size_t i = 0; densityMapSupported && i < eyeImageCount; i++) {
+        vkDestroyImageView(device, densityViews[i], nullptr);
+        vkDestroyImage(device, densityImages[i], nullptr);
+        vkFreeMemory(device, densityMemories[i], nullptr);
+        vkDestroyBuffer(device, densityStagingBuffers[i], nullptr);
+        vkFreeMemory(device, densityStagingMemories[i], nullptr);
+    }
+    vkDestroyDescriptorPool(device, ssaoDescriptorPool, nullptr);
+    vkDestroyPipeline(device, ssaoPipeline, nullptr);
+    vkDestroyPipelineLayout(device, ssaoPipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, ssaoDescriptorSetLayout, nullptr);
+    vkDestroyShaderModule(device, ssaoShader, nullptr);
+    for (size_t i = 0; i < eyeImageCount; i++) {
+        vkDestroyImageView(device, eyeOcclusionViews[i], nullptr);
+        vkDestroyImage(device, eyeOcclusionImages[i], nullptr);
+        vkFreeMemory(device, eyeOcclusionMemories[i], nullptr);
+        vkDestroyImageView(device, eyeDepthViews[i], nullptr);
+        vkDestroyImage(device, eyeDepthImages[i], nullptr);
+        vkFreeMemory(device, eyeDepthMemories[i], nullptr);
+        vkDestroyImageView(device, eyeColorViews[i], nullptr);
+        vkDestroyImage(device, eyeColorImages[i], nullptr);
+        vkFreeMemory(device, eyeColorMemories[i], nullptr);
+    }
+    vkDestroyBuffer(device, fragmentBuffer, nullptr);
+    vkFreeMemory(device, fragmentMemory, nullptr);
+    vkDestroyImageView(device, fragmentHeadView, nullptr);
+    vkDestroyImage(device, fragmentHeadImage, nullptr);
+    vkFreeMemory(device, fragmentHeadMemory, nullptr);
+    vkDestroyImageView(device, revealageView, nullptr);
+    vkDestroyImage(device, revealageImage, nullptr);
+    vkFreeMemory(device, revealageMemory, nullptr);
+    vkDestroyImageView(device, accumulationView, nullptr);
+    vkDestroyImage(device, accumulationImage, nullptr);
+    vkFreeMemory(device, accumulationMemory, nullptr);
     vkDestroyImageView(device, colorView, nullptr);
     vkDestroyImage(device, colorImage, nullptr);
     vkFreeMemory(device, colorMemory, nullptr);
-    vkDestroyPipeline(device, rightGraphicsPipeline, nullptr);
-    vkDestroyPipeline(device, leftGraphicsPipeline, nullptr);
+    vkDestroyPipeline(device, compositePipeline, nullptr);
+    vkDestroyPipeline(device, transparentPipeline, nullptr);
+    vkDestroyPipeline(device, graphicsPipeline, nullptr);
     vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
     vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+    vkDestroyPipeline(device, warpPipeline, nullptr);
+    vkDestroyPipelineLayout(device, warpPipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, warpDescriptorSetLayout, nullptr);
+    vkDestroyRenderPass(device, warpRenderPass, nullptr);
     vkDestroyRenderPass(device, renderPass, nullptr);
+    vkDestroyShaderModule(device, warpFragmentShader, nullptr);
+    vkDestroyShaderModule(device, warpVertexShader, nullptr);
+    vkDestroyShaderModule(device, compositeFragmentShader, nullptr);
+    vkDestroyShaderModule(device, compositeVertexShader, nullptr);
+    vkDestroyShaderModule(device, transparentShader, nullptr);
     vkDestroyShaderModule(device, fragmentShader, nullptr);
     vkDestroyShaderModule(device, vertexShader, nullptr);
     for (auto imageView : swapchainViews)
         vkDestroyImageView(device, imageView, nullptr);
     vkDestroySwapchainKHR(device, swapchain, nullptr);
+    {
+        std::lock_guard<std::mutex> lock(recordMutex);
+        recordRunning = false;
+    }
+    recordCondition.notify_all();
+    for (auto &worker : recordWorkers) {
+        if (worker.thread.joinable())
+            worker.thread.join();
+        for (auto pool : worker.pools)
+            vkDestroyCommandPool(device, pool, nullptr);
+    }
+    // Their buffers died with the pools, the next window creates fresh workers
+    recordWorkers.clear();
+    if (occlusionJob.commandBuffer != VK_NULL_HANDLE)
+        releaseComputeJob(occlusionJob);
+    for (auto timeline : {&sceneTimeline, &warpTimeline, &computeTimeline, &transferTimeline})
+        destroyTimeline(*timeline);
+    vkDestroyCommandPool(device, transferPool, nullptr);
+    vkDestroyCommandPool(device, computePool, nullptr);
     vkDestroyCommandPool(device, commandPool, nullptr);
     vkDestroyDevice(device, nullptr);
-    vkDestroySurfaceKHR(instance, surface, nullptr);
-    auto destroyDebugUtilsMessenger = (PFN_vkDestroyDebugUtilsMessengerEXT)
-            vkGetInstanceProcAddr(instance, "vkDestroyDebugUtilsMessengerEXT");
-    destroyDebugUtilsMessenger(instance, messenger, nullptr);
-    vkDestroyInstance(instance, nullptr);
+    clearInstance();
+}
+
+// Runs on its own looper so sensor bursts never delay lifecycle commands or frames
+void pollSensors() {
+    ALooper *looper = ALooper_prepare(0);
+
+    auto sensorManager = ASensorManager_getInstance();
+    auto sensorQueue = ASensorManager_createEventQueue(sensorManager, looper, LOOPER_ID_USER,
+                                                       nullptr, nullptr);
+
+    const ASensor *physicalSensors[] = {
+            ASensorManager_getDefaultSensor(sensorManager, ASENSOR_TYPE_GYROSCOPE),
+            ASensorManager_getDefaultSensor(sensorManager, ASENSOR_TYPE_ACCELEROMETER),
+            ASensorManager_getDefaultSensor(sensorManager, ASENSOR_TYPE_MAGNETIC_FIELD)
+    };
+
+    for (auto physicalSensor : physicalSensors) {
+        if (!physicalSensor)
+            continue;
+
+        ASensorEventQueue_enableSensor(sensorQueue, physicalSensor);
+        ASensorEventQueue_setEventRate(sensorQueue, physicalSensor,
+                                       std::max(ASensor_getMinDelay(physicalSensor), 5000));
+    }
+
+    ASensorEvent event{};
+    sensorLooper = looper;
+
+    while (sensorRunning) {
+        ALooper_pollAll(-1, nullptr, nullptr, nullptr);
+
+        while (ASensorEventQueue_getEvents(sensorQueue, &event, 1) > 0) {
+            SensorRecord record{SENSOR_GYROSCOPE, event.timestamp,
+                                glm::vec3(event.vector.x, event.vector.y, event.vector.z)};
+            if (event.type == ASENSOR_TYPE_ACCELEROMETER)
+                record.type = SENSOR_ACCELEROMETER;
+            else if (event.type == ASENSOR_TYPE_MAGNETIC_FIELD)
+                record.type = SENSOR_MAGNETOMETER;
+            else if (event.type != ASENSOR_TYPE_GYROSCOPE)
+                continue;
+
+            pushSensorRecord(sensorRecords, record);
+        }
+    }
+
+    for (auto physicalSensor : physicalSensors)
+        if (physicalSensor)
+            ASensorEventQueue_disableSensor(sensorQueue, physicalSensor);
+    ASensorManager_destroyEventQueue(sensorManager, sensorQueue);
+}
+
+// Owns the device queues while a window exists, paced by timeline waits and FIFO present
+void renderLoop() {
+    uint32_t previousFrame = 0, currentFrame = 0;
+    uint64_t currentTime, previousTime = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+
+    while (rendering) {
+        int64_t startTime = scheduleFrame(pacer, steadyNanoseconds());
+        std::this_thread::sleep_until(
+                std::chrono::steady_clock::time_point(std::chrono::nanoseconds(startTime)));
+        frameStartTime = steadyNanoseconds();
+        draw();
+
+        currentTime = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+
+        if (currentTime - previousTime > 1000) {
+            LOG("FPS: %d\n", currentFrame - previousFrame);
+            if (latchCount && sceneLatchCount)
+                LOG("Pose latched %.2f ms later than culling, %.2f ms before submit\n",
+                    latchGain / sceneLatchCount, latchDelay / latchCount);
+            if (pacer.presentedFrames)
+                LOG("Missed %u of %u frame deadlines\n", pacer.missedFrames, pacer.presentedFrames);
+            if (ssaoEnabled && timestampsSupported)
+                LOG("Screen-space occlusion %.2f ms of %.2f ms scene GPU time\n", ssaoTime, sceneTime);
+            latchGain = latchDelay = 0.0;
+            sceneLatchCount = latchCount = 0;
+            pacer.presentedFrames = pacer.missedFrames = 0;
+            previousFrame = currentFrame;
+            previousTime = currentTime;
+        }
+
+        currentFrame++;
+    }
+}
+
+void stopRendering() {
+    if (!renderThread.joinable())
+        return;
+
+    rendering = false;
+    renderThread.join();
+    clear();
 }
 
 void handle_cmd(android_app *pApp, int32_t cmd) {
     if (cmd == APP_CMD_INIT_WINDOW) {
         app = pApp;
-        setup();
+        if (!setup()) {
+            app = nullptr;
+            ANativeActivity_finish(pApp->activity);
+            return;
+        }
         pApp->userData = (void *) 1;
+        rendering = true;
+        renderThread = std::thread(renderLoop);
     } else if (cmd == APP_CMD_TERM_WINDOW) {
         pApp->userData = nullptr;
-        clear();
+        stopRendering();
         app = nullptr;
     }
 }
 
+// Dragging across the screen scrubs the trajectory, its horizontal position picks the frame
+int32_t handle_input(android_app *pApp, AInputEvent *event) {
+    if (AInputEvent_getType(event) != AINPUT_EVENT_TYPE_MOTION || !pApp->window)
+        return 0;
+
+    int32_t action = AMotionEvent_getAction(event) & AMOTION_EVENT_ACTION_MASK;
+    if (action != AMOTION_EVENT_ACTION_DOWN && action != AMOTION_EVENT_ACTION_MOVE)
+        return 0;
+
+    seekPosition = glm::clamp(AMotionEvent_getX(event, 0) / ANativeWindow_getWidth(pApp->window), 0.0f, 1.0f);
+    return 1;
+}
+
 void android_main(struct android_app *pApp) {
     pApp->onAppCmd = handle_cmd;
+    pApp->onInputEvent = handle_input;
 
     int events;
     android_poll_source *pSource;
 
-    auto sensorManager = ASensorManager_getInstance();
-    auto physicalSensor = ASensorManager_getDefaultSensor(sensorManager, ASENSOR_TYPE_GYROSCOPE);
-    sensorQueue = ASensorManager_createEventQueue(sensorManager, pApp->looper, LOOPER_ID_USER,
-                                                  nullptr, nullptr);
-    ASensorEventQueue_enableSensor(sensorQueue, physicalSensor);
-    ASensorEventQueue_setEventRate(sensorQueue, physicalSensor, 16666);
+    resetTracker(tracker);
+    resetPredictor(predictor);
+    if (recordSensors && pApp->activity->externalDataPath)
+        sensorLog.open(std::string(pApp->activity->externalDataPath) + "/sensors.log");
 
-    uint32_t previousFrame = 0, currentFrame = 0;
-    uint64_t currentTime, previousTime = std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::system_clock::now().time_since_epoch()).count();
+    resetSensorQueue(sensorRecords);
+    sensorLooper = nullptr;
+    sensorRunning = true;
+    sensorThread = std::thread(pollSensors);
 
-    do {
-        if (ALooper_pollAll(0, nullptr, &events, (void **) &pSource) >= 0 && pSource)
+    // Only lifecycle commands and touches are handled here, so block until one arrives
+    while (!pApp->destroyRequested)
+        if (ALooper_pollAll(-1, nullptr, &events, (void **) &pSource) >= 0 && pSource)
             pSource->process(pApp, pSource);
 
-        if (pApp->userData) {
-            draw();
-
-            currentTime = std::chrono::duration_cast<std::chrono::milliseconds>(
-                    std::chrono::system_clock::now().time_since_epoch()).count();
-
-            if (currentTime - previousTime > 1000) {
-                LOG("FPS: %d\n", currentFrame - previousFrame);
-                previousFrame = currentFrame;
-                previousTime = currentTime;
-            }
-
-            currentFrame++;
-        }
-    } while (!pApp->destroyRequested);
+    stopRendering();
 
-    ASensorEventQueue_disableSensor(sensorQueue, physicalSensor);
-    ASensorManager_destroyEventQueue(sensorManager, sensorQueue);
+    sensorRunning = false;
+    while (!sensorLooper)
+        std::this_thread::yield();
+    ALooper_wake(sensorLooper);
+    sensorThread.join();
+    sensorLog.close();
+    latencyLog.close();
 }
@@ -0,0 +1,100 @@
+#include "occlusion.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <functional>
+#include <thread>
+
+static const uint32_t maximumCellCount = 1 << 21;
+
+static glm::uvec3 cellOf(const OcclusionGrid &grid, const glm::vec3 &point) {
+    glm::vec3 cell = glm::floor((point - grid.origin) / grid.cellSize);
+    return glm::uvec3(glm::clamp(cell, glm::vec3(0.0f), glm::vec3(grid.dimensions - glm::uvec3(1))));
+}
+
+static uint32_t cellIndex(const OcclusionGrid &grid, const glm::uvec3 &cell) {
+    return (cell.z * grid.dimensions.y + cell.y) * grid.dimensions.x + cell.x;
+}
+
+// Counting sort of the points into cells, sparse structures grow the cells instead of the cell count
+void buildOcclusionGrid(const std::vector<glm::vec3> &points, float radius, OcclusionGrid &grid) {
+    glm::vec3 minimum(FLT_MAX), maximum(-FLT_MAX);
+    for (auto &point : points) {
+        minimum = glm::min(minimum, point);
+        maximum = glm::max(maximum, point);
+    }
+    if (points.empty())
+        minimum = maximum = glm::vec3(0.0f);
+
+    glm::vec3 extent = maximum - minimum;
+    grid.origin = minimum;
+    grid.cellSize = glm::max(radius, 1e-3f);
+    while (true) {
+        grid.dimensions = glm::uvec3(glm::floor(extent / grid.cellSize)) + glm::uvec3(1);
+        if ((uint64_t) grid.dimensions.x * grid.dimensions.y * grid.dimensions.z <= maximumCellCount)
+            break;
+        grid.cellSize *= 2.0f;
+    }
+
+    uint32_t cellCount = grid.dimensions.x * grid.dimensions.y * grid.dimensions.z;
+    grid.cellStarts.assign(cellCount + 1, 0);
+    grid.pointIndices.resize(points.size());
+
+    std::vector<uint32_t> cells(points.size());
+    for (uint32_t i = 0; i < points.size(); i++) {
+        cells[i] = cellIndex(grid, cellOf(grid, points[i]));
+        grid.cellStarts[cells[i] + 1]++;
+    }
+
+    for (uint32_t i = 0; i < cellCount; i++)
+        grid.cellStarts[i + 1] += grid.cellStarts[i];
+
+    std::vector<uint32_t> cursors(grid.cellStarts.begin(), grid.cellStarts.end() - 1);
+    for (uint32_t i = 0; i < points.size(); i++)
+        grid.pointIndices[cursors[cells[i]]++] = i;
+}
+
+// Neighbours fall off quadratically with distance, so coverage stays smooth as atoms move across the radius
+void bakeOcclusion(const std::vector<glm::vec3> &points, const OcclusionGrid &grid,
+                   const OcclusionSettings &settings, uint32_t first, uint32_t last, uint8_t *occlusion) {
+    for (uint32_t i = first; i < last; i++) {
+        glm::uvec3 cell = cellOf(grid, points[i]);
+        glm::uvec3 lower = glm::max(cell, glm::uvec3(1)) - glm::uvec3(1);
+        glm::uvec3 upper = glm::min(cell + glm::uvec3(1), grid.dimensions - glm::uvec3(1));
+        float coverage = 0.0f;
+
+        for (uint32_t z = lower.z; z <= upper.z; z++)
+            for (uint32_t y = lower.y; y <= upper.y; y++)
+                for (uint32_t x = lower.x; x <= upper.x; x++) {
+                    uint32_t index = cellIndex(grid, glm::uvec3(x, y, z));
+                    for (uint32_t j = grid.cellStarts[index]; j < grid.cellStarts[index + 1]; j++) {
+                        uint32_t neighbor = grid.pointIndices[j];
+                        float distance = glm::distance(points[i], points[neighbor]);
+                        if (neighbor == i || distance >= settings.radius)
+                            continue;
+
+                        float falloff = 1.0f - distance / settings.radius;
+                        coverage += falloff * falloff;
+                    }
+                }
+
+        float visibility = 1.0f - settings.strength * glm::min(coverage / settings.saturation, 1.0f);
+        occlusion[i] = (uint8_t) glm::round(glm::clamp(visibility, 0.0f, 1.0f) * 255.0f);
+    }
+}
+
+void bakeOcclusionParallel(const std::vector<glm::vec3> &points, const OcclusionGrid &grid,
+                           const OcclusionSettings &settings, uint32_t threadCount, uint8_t *occlusion) {
+    uint32_t pointCount = points.size();
+    threadCount = std::max(std::min(threadCount, pointCount / 1024), 1u);
+    uint32_t batch = (pointCount + threadCount - 1) / threadCount;
+
+    std::vector<std::thread> threads;
+    for (uint32_t first = batch; first < pointCount; first += batch)
+        threads.emplace_back(bakeOcclusion, std::cref(points), std::cref(grid), std::cref(settings), first,
+                             std::min(first + batch, pointCount), occlusion);
+
+    bakeOcclusion(points, grid, settings, 0, std::min(batch, pointCount), occlusion);
+    for (auto &thread : threads)
+        thread.join();
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#define GLM_FORCE_DEFAULT_ALIGNED_GENTYPES
+
+#include <glm/glm.hpp>
+
+// Uniform grid at least one sampling radius per cell, the points of cell i are pointIndices[cellStarts[i]..]
+struct OcclusionGrid {
+    glm::vec3 origin;
+    float cellSize;
+    glm::uvec3 dimensions;
+    std::vector<uint32_t> cellStarts;
+    std::vector<uint32_t> pointIndices;
+};
+
+// Neighbour coverage inside radius darkens a point, down to 1 - strength once it reaches saturation
+struct OcclusionSettings {
+    float radius;
+    float saturation;
+    float strength;
+};
+
+void buildOcclusionGrid(const std::vector<glm::vec3> &points, float radius, OcclusionGrid &grid);
+void bakeOcclusion(const std::vector<glm::vec3> &points, const OcclusionGrid &grid,
+                   const OcclusionSettings &settings, uint32_t first, uint32_t last, uint8_t *occlusion);
+void bakeOcclusionParallel(const std::vector<glm::vec3> &points, const OcclusionGrid &grid,
+                           const OcclusionSettings &settings, uint32_t threadCount, uint8_t *occlusion);
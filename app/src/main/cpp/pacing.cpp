@@ -0,0 +1,62 @@
+#include "pacing.h"
+
+#include <algorithm>
+#include <cmath>
+
+static const int64_t minimumMargin = 1000000;
+
+// A target rate of zero follows the display, other rates present every few refresh cycles
+void resetPacer(FramePacer &pacer, int64_t refreshPeriod, uint32_t targetRate) {
+    pacer.refreshPeriod = refreshPeriod;
+    pacer.vsyncTime = 0;
+    pacer.frameWork = refreshPeriod / 2;
+    pacer.margin = std::max(refreshPeriod / 10, minimumMargin);
+    pacer.deadline = 0;
+    pacer.targetRate = targetRate;
+    pacer.interval = 1;
+    pacer.presentedFrames = 0;
+    pacer.missedFrames = 0;
+    pacer.phaseKnown = false;
+
+    if (targetRate && refreshPeriod > 0)
+        pacer.interval = std::max((uint32_t) std::lround(1e9 / refreshPeriod / targetRate), 1u);
+}
+
+void updatePacer(FramePacer &pacer, const FrameTiming &timing) {
+    // Present feedback lands exactly on vsync, which pins the phase of the grid
+    if (timing.presentTime) {
+        pacer.vsyncTime = std::max(pacer.vsyncTime, timing.presentTime);
+        pacer.phaseKnown = true;
+    }
+
+    int64_t finished = timing.gpuTime ? timing.gpuTime : timing.submitTime;
+    if (timing.startTime && finished > timing.startTime) {
+        int64_t work = finished - timing.startTime;
+        pacer.frameWork = work > pacer.frameWork ? work : pacer.frameWork + (work - pacer.frameWork) / 8;
+    }
+
+    int64_t shown = timing.presentTime ? timing.presentTime : timing.gpuTime;
+    if (!shown || !timing.deadline)
+        return;
+
+    pacer.presentedFrames++;
+    if (shown > timing.deadline + pacer.refreshPeriod / 2)
+        pacer.missedFrames++;
+}
+
+// Picks the next deadline the frame can still make and returns when work on it should start
+int64_t scheduleFrame(FramePacer &pacer, int64_t now) {
+    int64_t lead = pacer.frameWork + pacer.margin;
+    int64_t deadline = now + lead;
+
+    if (pacer.phaseKnown && pacer.refreshPeriod > 0) {
+        int64_t cycles = (deadline - pacer.vsyncTime + pacer.refreshPeriod - 1) / pacer.refreshPeriod;
+        deadline = pacer.vsyncTime + std::max(cycles, (int64_t) 0) * pacer.refreshPeriod;
+    }
+
+    if (pacer.deadline)
+        deadline = std::max(deadline, pacer.deadline + pacer.interval * pacer.refreshPeriod);
+
+    pacer.deadline = deadline;
+    return deadline - lead;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+
+#include "latency.h"
+
+// Schedules frame starts against the display vsync grid so each frame completes just before its deadline
+struct FramePacer {
+    int64_t refreshPeriod;
+    int64_t vsyncTime;
+    int64_t frameWork;
+    int64_t margin;
+    int64_t deadline;
+    uint32_t targetRate;
+    uint32_t interval;
+    uint32_t presentedFrames;
+    uint32_t missedFrames;
+    bool phaseKnown;
+};
+
+void resetPacer(FramePacer &pacer, int64_t refreshPeriod, uint32_t targetRate);
+void updatePacer(FramePacer &pacer, const FrameTiming &timing);
+int64_t scheduleFrame(FramePacer &pacer, int64_t now);
@@ -0,0 +1,243 @@
+#include "rendergraph.h"
+
+#include <map>
+#include <utility>
+
+struct GraphUse {
+    VkImageLayout layout;
+    VkPipelineStageFlags stages;
+    VkAccessFlags access;
+    bool write;
+};
+
+static const VkAccessFlags writeAccess = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+static bool depthFormat(VkFormat format) {
+    return format == VK_FORMAT_D32_SFLOAT || format == VK_FORMAT_D32_SFLOAT_S8_UINT ||
+           format == VK_FORMAT_D24_UNORM_S8_UINT || format == VK_FORMAT_X8_D24_UNORM_PACK32 ||
+           format == VK_FORMAT_D16_UNORM;
+}
+
+// Attachments a pass does not reference come back without stages
+static GraphUse passUse(const RenderGraph &graph, const GraphPass &pass, uint32_t attachment) {
+    GraphUse use{VK_IMAGE_LAYOUT_UNDEFINED, 0, 0, false};
+
+    for (auto color : pass.colors)
+        if (color == attachment)
+            use = {VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                   VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, true};
+
+    for (auto resolve : pass.resolves)
+        if (resolve == attachment)
+            use = {VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                   VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, true};
+
+    if (pass.depth == attachment) {
+        use = {VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+               VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+               VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT, false};
+        if (pass.depthWrite) {
+            use.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+            use.access |= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+            use.write = true;
+        }
+    }
+
+    for (auto input : pass.inputs)
+        if (input == attachment) {
+            if (use.layout == VK_IMAGE_LAYOUT_UNDEFINED)
+                use.layout = depthFormat(graph.attachments[attachment].format)
+                             ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL
+                             : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            use.stages |= VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+            use.access |= VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
+        }
+
+    return use;
+}
+
+// Dependencies between the same pair of subpasses are merged, one that leaves the region drops the flag for all
+static void addDependency(CompiledGraph &compiled, std::map<std::pair<uint32_t, uint32_t>, size_t> &indices,
+                          uint32_t src, uint32_t dst, VkPipelineStageFlags srcStages, VkAccessFlags srcAccess,
+                          VkPipelineStageFlags dstStages, VkAccessFlags dstAccess, bool byRegion) {
+    auto key = std::make_pair(src, dst);
+    if (!indices.count(key)) {
+        indices[key] = compiled.dependencies.size();
+        VkSubpassDependency dependency{};
+        dependency.srcSubpass = src;
+        dependency.dstSubpass = dst;
+        dependency.dependencyFlags = byRegion ? VK_DEPENDENCY_BY_REGION_BIT : 0;
+        compiled.dependencies.push_back(dependency);
+    }
+
+    VkSubpassDependency &dependency = compiled.dependencies[indices[key]];
+    dependency.srcStageMask |= srcStages;
+    dependency.srcAccessMask |= srcAccess;
+    dependency.dstStageMask |= dstStages;
+    dependency.dstAccessMask |= dstAccess;
+    if (!byRegion)
+        dependency.dependencyFlags &= ~VK_DEPENDENCY_BY_REGION_BIT;
+}
+
+// Load and store ops follow from whether contents cross the graph edges, dependencies from the order of uses
+void compileRenderGraph(const RenderGraph &graph, CompiledGraph &compiled) {
+    uint32_t passCount = graph.passes.size();
+    std::map<std::pair<uint32_t, uint32_t>, size_t> indices;
+
+    compiled = CompiledGraph();
+    compiled.preserves.resize(passCount);
+
+    for (uint32_t a = 0; a < graph.attachments.size(); a++) {
+        const GraphAttachment &attachment = graph.attachments[a];
+        std::vector<GraphUse> uses(passCount);
+        uint32_t first = VK_ATTACHMENT_UNUSED, last = VK_ATTACHMENT_UNUSED;
+        for (uint32_t p = 0; p < passCount; p++) {
+            uses[p] = passUse(graph, graph.passes[p], a);
+            if (uses[p].stages && first == VK_ATTACHMENT_UNUSED)
+                first = p;
+            if (uses[p].stages)
+                last = p;
+        }
+
+        VkAttachmentDescription description{};
+        description.format = attachment.format;
+        description.samples = attachment.samples;
+        description.loadOp = attachment.loaded ? VK_ATTACHMENT_LOAD_OP_LOAD :
+                             attachment.cleared ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        description.storeOp = attachment.stored ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        description.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        description.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        description.initialLayout = attachment.loaded ? attachment.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+        description.finalLayout = attachment.stored || first == VK_ATTACHMENT_UNUSED ? attachment.layout
+                                                                                     : uses[last].layout;
+        compiled.attachments.push_back(description);
+
+        if (first == VK_ATTACHMENT_UNUSED)
+            continue;
+
+        addDependency(compiled, indices, VK_SUBPASS_EXTERNAL, first, uses[first].stages, 0,
+                      uses[first].stages, uses[first].access, false);
+
+        // Reads wait for the last write, writes also wait for the reads since then
+        uint32_t writer = VK_ATTACHMENT_UNUSED;
+        std::vector<uint32_t> readers;
+        for (uint32_t p = first; p <= last; p++) {
+            if (!uses[p].stages) {
+                compiled.preserves[p].push_back(a);
+                continue;
+            }
+
+            if (writer != VK_ATTACHMENT_UNUSED)
+                addDependency(compiled, indices, writer, p, uses[writer].stages, uses[writer].access & writeAccess,
+                              uses[p].stages, uses[p].access, true);
+            if (uses[p].write)
+                for (auto reader : readers)
+                    addDependency(compiled, indices, reader, p, uses[reader].stages, 0, uses[p].stages,
+                                  uses[p].access, true);
+
+            if (uses[p].write) {
+                writer = p;
+                readers.clear();
+            } else {
+                readers.push_back(p);
+            }
+        }
+
+        if (attachment.stored && attachment.readStages) {
+            addDependency(compiled, indices, last, VK_SUBPASS_EXTERNAL, uses[last].stages,
+                          uses[last].access & writeAccess, attachment.readStages, VK_ACCESS_SHADER_READ_BIT, false);
+            if (writer != VK_ATTACHMENT_UNUSED && writer != last)
+                addDependency(compiled, indices, writer, VK_SUBPASS_EXTERNAL, uses[writer].stages,
+                              uses[writer].access & writeAccess, attachment.readStages, VK_ACCESS_SHADER_READ_BIT,
+                              false);
+        }
+    }
+
+    // Storage written by one pass is read through buffers by the next, which is never local to a region
+    uint32_t storageWriter = VK_ATTACHMENT_UNUSED;
+    for (uint32_t p = 0; p < passCount; p++) {
+        if (!graph.passes[p].storage)
+            continue;
+        if (storageWriter != VK_ATTACHMENT_UNUSED)
+            addDependency(compiled, indices, storageWriter, p, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                          VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                          VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, false);
+        storageWriter = p;
+    }
+
+    compiled.colors.resize(passCount);
+    compiled.resolves.resize(passCount);
+    compiled.inputs.resize(passCount);
+    compiled.depths.resize(passCount);
+
+    for (uint32_t p = 0; p < passCount; p++) {
+        const GraphPass &pass = graph.passes[p];
+        for (auto color : pass.colors)
+            compiled.colors[p].push_back({color, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL});
+        for (auto resolve : pass.resolves)
+            compiled.resolves[p].push_back({resolve, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL});
+        for (auto input : pass.inputs)
+            compiled.inputs[p].push_back({input, passUse(graph, pass, input).layout});
+        if (pass.depth != VK_ATTACHMENT_UNUSED)
+            compiled.depths[p] = {pass.depth, passUse(graph, pass, pass.depth).layout};
+    }
+
+    compiled.subpasses.resize(passCount);
+    for (uint32_t p = 0; p < passCount; p++) {
+        VkSubpassDescription &subpass = compiled.subpasses[p];
+        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass.colorAttachmentCount = compiled.colors[p].size();
+        subpass.pColorAttachments = compiled.colors[p].data();
+        subpass.pResolveAttachments = compiled.resolves[p].empty() ? nullptr : compiled.resolves[p].data();
+        subpass.inputAttachmentCount = compiled.inputs[p].size();
+        subpass.pInputAttachments = compiled.inputs[p].data();
+        subpass.pDepthStencilAttachment = graph.passes[p].depth != VK_ATTACHMENT_UNUSED ? &compiled.depths[p]
+                                                                                         : nullptr;
+        subpass.preserveAttachmentCount = compiled.preserves[p].size();
+        subpass.pPreserveAttachments = compiled.preserves[p].data();
+    }
+
+    compiled.renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    compiled.renderPassInfo.attachmentCount = compiled.attachments.size();
+    compiled.renderPassInfo.pAttachments = compiled.attachments.data();
+    compiled.renderPassInfo.subpassCount = compiled.subpasses.size();
+    compiled.renderPassInfo.pSubpasses = compiled.subpasses.data();
+    compiled.renderPassInfo.dependencyCount = compiled.dependencies.size();
+    compiled.renderPassInfo.pDependencies = compiled.dependencies.data();
+
+    if (graph.densityMap != VK_ATTACHMENT_UNUSED) {
+        compiled.densityInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_FRAGMENT_DENSITY_MAP_CREATE_INFO_EXT;
+        compiled.densityInfo.fragmentDensityMapAttachment.attachment = graph.densityMap;
+        compiled.densityInfo.fragmentDensityMapAttachment.layout = graph.attachments[graph.densityMap].layout;
+        compiled.renderPassInfo.pNext = &compiled.densityInfo;
+    }
+}
+
+// Contents that never leave the graph can live in tile memory only
+bool transientAttachment(const RenderGraph &graph, uint32_t attachment) {
+    return !graph.attachments[attachment].loaded && !graph.attachments[attachment].stored;
+}
+
+VkImageUsageFlags attachmentUsage(const RenderGraph &graph, uint32_t attachment) {
+    VkImageUsageFlags usage = transientAttachment(graph, attachment) ? VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT : 0;
+    for (auto &pass : graph.passes) {
+        for (auto color : pass.colors)
+            if (color == attachment)
+                usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+        for (auto resolve : pass.resolves)
+            if (resolve == attachment)
+                usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+        for (auto input : pass.inputs)
+            if (input == attachment)
+                usage |= VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+        if (pass.depth == attachment)
+            usage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    }
+    return usage;
+}
+
+VkMemoryPropertyFlags attachmentMemory(const RenderGraph &graph, uint32_t attachment) {
+    return VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+           (transientAttachment(graph, attachment) ? VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT : 0);
+}
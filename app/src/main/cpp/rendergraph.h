@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+// Layout is the one outside the graph, contents are only kept across its edges when loaded or stored
+struct GraphAttachment {
+    VkFormat format;
+    VkSampleCountFlagBits samples;
+    VkImageLayout layout;
+    VkPipelineStageFlags readStages;
+    bool cleared;
+    bool loaded;
+    bool stored;
+};
+
+// Inputs are read at the same pixel, resolves pair with colors, storage passes share buffers outside the graph
+struct GraphPass {
+    std::vector<uint32_t> colors;
+    std::vector<uint32_t> resolves;
+    std::vector<uint32_t> inputs;
+    uint32_t depth;
+    bool depthWrite;
+    bool storage;
+};
+
+// Passes rendering to one framebuffer, merged into the subpasses of a single render pass
+struct RenderGraph {
+    std::vector<GraphAttachment> attachments;
+    std::vector<GraphPass> passes;
+    uint32_t densityMap;
+};
+
+// Owns everything renderPassInfo points to, so it has to outlive render pass creation
+struct CompiledGraph {
+    std::vector<VkAttachmentDescription> attachments;
+    std::vector<std::vector<VkAttachmentReference>> colors, resolves, inputs;
+    std::vector<VkAttachmentReference> depths;
+    std::vector<std::vector<uint32_t>> preserves;
+    std::vector<VkSubpassDescription> subpasses;
+    std::vector<VkSubpassDependency> dependencies;
+    VkRenderPassFragmentDensityMapCreateInfoEXT densityInfo;
+    VkRenderPassCreateInfo renderPassInfo;
+};
+
+void compileRenderGraph(const RenderGraph &graph, CompiledGraph &compiled);
+bool transientAttachment(const RenderGraph &graph, uint32_t attachment);
+VkImageUsageFlags attachmentUsage(const RenderGraph &graph, uint32_t attachment);
+VkMemoryPropertyFlags attachmentMemory(const RenderGraph &graph, uint32_t attachment);
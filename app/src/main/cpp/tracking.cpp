@@ -0,0 +1,277 @@
+#include "tracking.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+static const float standardGravity = 9.80665f;
+static const float gravityTolerance = 1.5f;
+static const int64_t sampleTimeout = 100000000;
+
+static glm::quat rotationBetween(const glm::vec3 &from, const glm::vec3 &to) {
+    float cosine = glm::dot(from, to);
+    if (cosine < -0.9999f) {
+        glm::vec3 axis = glm::cross(glm::vec3(1.0f, 0.0f, 0.0f), from);
+        if (glm::dot(axis, axis) < 1e-6f)
+            axis = glm::cross(glm::vec3(0.0f, 1.0f, 0.0f), from);
+        return glm::angleAxis(glm::pi<float>(), glm::normalize(axis));
+    }
+
+    glm::vec3 axis = glm::cross(from, to);
+    return glm::normalize(glm::quat(1.0f + cosine, axis.x, axis.y, axis.z));
+}
+
+void resetTracker(HeadTracker &tracker) {
+    tracker.orientation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+    tracker.angularVelocity = glm::vec3(0.0f);
+    tracker.integralError = glm::vec3(0.0f);
+    tracker.gravity = glm::vec3(0.0f);
+    tracker.magneticField = glm::vec3(0.0f);
+    tracker.magneticReference = glm::vec3(0.0f);
+    tracker.timestamp = 0;
+    tracker.gravityTimestamp = INT64_MIN;
+    tracker.magneticTimestamp = INT64_MIN;
+    tracker.proportionalGain = 0.5f;
+    tracker.integralGain = 0.1f;
+    tracker.magneticGain = 0.2f;
+    tracker.initialized = false;
+    tracker.hasReference = false;
+}
+
+// Phone lies landscape in the headset, so device +X points up and -Y points left
+glm::vec3 deviceToHead(const glm::vec3 &vector) {
+    return glm::vec3(-vector.y, -vector.z, vector.x);
+}
+
+static glm::vec3 correctionError(HeadTracker &tracker, int64_t timestamp) {
+    glm::vec3 error(0.0f);
+
+    float strength = glm::length(tracker.gravity);
+    if (timestamp - tracker.gravityTimestamp < sampleTimeout &&
+            glm::abs(strength - standardGravity) < gravityTolerance) {
+        glm::vec3 measured = tracker.gravity / strength;
+        glm::vec3 estimated = glm::conjugate(tracker.orientation) * glm::vec3(0.0f, 0.0f, 1.0f);
+        error += glm::cross(measured, estimated);
+    }
+
+    if (timestamp - tracker.magneticTimestamp < sampleTimeout && glm::length(tracker.magneticField) > 0.0f) {
+        glm::vec3 field = tracker.orientation * tracker.magneticField;
+        glm::vec3 horizontal(field.x, field.y, 0.0f);
+
+        if (glm::length(horizontal) > 1e-3f) {
+            horizontal = glm::normalize(horizontal);
+            if (!tracker.hasReference) {
+                tracker.magneticReference = horizontal;
+                tracker.hasReference = true;
+            }
+
+            // Only yaw is corrected from the compass, tilt is left to gravity
+            glm::vec3 yaw(0.0f, 0.0f, glm::cross(horizontal, tracker.magneticReference).z);
+            error += tracker.magneticGain / tracker.proportionalGain *
+                    (glm::conjugate(tracker.orientation) * yaw);
+        }
+    }
+
+    return error;
+}
+
+static void updateGyroscope(HeadTracker &tracker, int64_t timestamp, const glm::vec3 &rate) {
+    if (!tracker.initialized) {
+        tracker.timestamp = timestamp;
+        tracker.initialized = true;
+        return;
+    }
+
+    if (timestamp <= tracker.timestamp)
+        return;
+
+    float interval = glm::min((timestamp - tracker.timestamp) * 1e-9f, 0.1f);
+    tracker.timestamp = timestamp;
+
+    glm::vec3 error = correctionError(tracker, timestamp);
+    tracker.integralError += tracker.integralGain * error * interval;
+    tracker.angularVelocity = rate + tracker.integralError;
+
+    glm::vec3 corrected = tracker.angularVelocity + tracker.proportionalGain * error;
+    float angle = glm::length(corrected) * interval;
+    if (angle > 0.0f)
+        tracker.orientation = tracker.orientation * glm::angleAxis(angle, glm::normalize(corrected));
+
+    tracker.orientation = glm::normalize(tracker.orientation);
+}
+
+static void updateAccelerometer(HeadTracker &tracker, int64_t timestamp, const glm::vec3 &acceleration) {
+    // Level the horizon from the first gravity sample instead of converging to it over seconds
+    if (tracker.gravityTimestamp == INT64_MIN && glm::length(acceleration) > 0.0f)
+        tracker.orientation = rotationBetween(glm::normalize(acceleration), glm::vec3(0.0f, 0.0f, 1.0f));
+
+    tracker.gravity = acceleration;
+    tracker.gravityTimestamp = timestamp;
+}
+
+void updateTracker(HeadTracker &tracker, const SensorRecord &record) {
+    glm::vec3 value = deviceToHead(record.value);
+
+    if (record.type == SENSOR_GYROSCOPE) {
+        updateGyroscope(tracker, record.timestamp, value);
+    } else if (record.type == SENSOR_ACCELEROMETER) {
+        updateAccelerometer(tracker, record.timestamp, value);
+    } else if (record.type == SENSOR_MAGNETOMETER) {
+        tracker.magneticField = value;
+        tracker.magneticTimestamp = record.timestamp;
+    }
+}
+
+void resetPredictor(PosePredictor &predictor) {
+    predictor.angularVelocity = glm::vec3(0.0f);
+    predictor.angularAcceleration = glm::vec3(0.0f);
+    predictor.timestamp = 0;
+    predictor.velocityTimeConstant = 0.005f;
+    predictor.accelerationTimeConstant = 0.06f;
+    predictor.accelerationWeight = 1.0f;
+    predictor.maximumHorizon = 0.08f;
+    predictor.initialized = false;
+}
+
+void updatePredictor(PosePredictor &predictor, const HeadTracker &tracker) {
+    if (!predictor.initialized) {
+        predictor.angularVelocity = tracker.angularVelocity;
+        predictor.angularAcceleration = glm::vec3(0.0f);
+        predictor.timestamp = tracker.timestamp;
+        predictor.initialized = true;
+        return;
+    }
+
+    if (tracker.timestamp <= predictor.timestamp)
+        return;
+
+    float interval = (tracker.timestamp - predictor.timestamp) * 1e-9f;
+    predictor.timestamp = tracker.timestamp;
+
+    float velocityWeight = 1.0f - glm::exp(-interval / glm::max(predictor.velocityTimeConstant, 1e-6f));
+    float accelerationWeight = 1.0f - glm::exp(-interval / glm::max(predictor.accelerationTimeConstant, 1e-6f));
+
+    glm::vec3 velocity = glm::mix(predictor.angularVelocity, tracker.angularVelocity, velocityWeight);
+    glm::vec3 acceleration = (velocity - predictor.angularVelocity) / interval;
+
+    predictor.angularAcceleration = glm::mix(predictor.angularAcceleration, acceleration, accelerationWeight);
+    predictor.angularVelocity = velocity;
+}
+
+glm::quat predictOrientation(const HeadTracker &tracker, const PosePredictor &predictor, float horizon) {
+    horizon = glm::clamp(horizon, 0.0f, predictor.maximumHorizon);
+
+    glm::vec3 rotation = predictor.angularVelocity * horizon +
+            0.5f * predictor.accelerationWeight * predictor.angularAcceleration * horizon * horizon;
+    float angle = glm::length(rotation);
+    if (angle < 1e-6f)
+        return tracker.orientation;
+
+    return glm::normalize(tracker.orientation * glm::angleAxis(angle, rotation / angle));
+}
+
+// Root mean square angle in radians between each prediction and the pose tracked horizon seconds later
+float benchmarkPredictor(const std::vector<SensorRecord> &records, const PosePredictor &settings, float horizon) {
+    HeadTracker tracker;
+    resetTracker(tracker);
+    PosePredictor predictor = settings;
+    predictor.initialized = false;
+
+    std::vector<int64_t> timestamps;
+    std::vector<glm::quat> orientations, predictions;
+
+    for (auto &record : records) {
+        updateTracker(tracker, record);
+        if (record.type != SENSOR_GYROSCOPE || !tracker.initialized)
+            continue;
+
+        updatePredictor(predictor, tracker);
+        timestamps.push_back(tracker.timestamp);
+        orientations.push_back(tracker.orientation);
+        predictions.push_back(predictOrientation(tracker, predictor, horizon));
+    }
+
+    double error = 0.0;
+    uint64_t count = 0;
+
+    for (size_t i = 0; i < timestamps.size(); i++) {
+        int64_t target = timestamps[i] + (int64_t) (horizon * 1e9f);
+        auto next = std::lower_bound(timestamps.begin(), timestamps.end(), target);
+        if (next == timestamps.end())
+            break;
+
+        size_t index = next - timestamps.begin();
+        glm::quat actual = orientations[index];
+        if (index > 0 && timestamps[index] != timestamps[index - 1]) {
+            float factor = (float) (target - timestamps[index - 1]) / (timestamps[index] - timestamps[index - 1]);
+            actual = glm::slerp(orientations[index - 1], orientations[index], factor);
+        }
+
+        float cosine = glm::min(glm::abs(glm::dot(actual, predictions[i])), 1.0f);
+        float angle = 2.0f * glm::acos(cosine);
+        error += angle * angle;
+        count++;
+    }
+
+    return count ? (float) glm::sqrt(error / count) : 0.0f;
+}
+
+void resetSensorQueue(SensorQueue &queue) {
+    queue.head.store(0, std::memory_order_relaxed);
+    queue.tail.store(0, std::memory_order_relaxed);
+}
+
+bool pushSensorRecord(SensorQueue &queue, const SensorRecord &record) {
+    uint32_t tail = queue.tail.load(std::memory_order_relaxed);
+    if (tail - queue.head.load(std::memory_order_acquire) == SensorQueue::capacity)
+        return false;
+
+    queue.records[tail % SensorQueue::capacity] = record;
+    queue.tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+bool popSensorRecord(SensorQueue &queue, SensorRecord &record) {
+    uint32_t head = queue.head.load(std::memory_order_relaxed);
+    if (head == queue.tail.load(std::memory_order_acquire))
+        return false;
+
+    record = queue.records[head % SensorQueue::capacity];
+    queue.head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+bool readSensorLog(const std::string &path, std::vector<SensorRecord> &records) {
+    std::ifstream file(path);
+    if (!file.is_open())
+        return false;
+
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream stream(line);
+        char type;
+        SensorRecord record{};
+
+        if (!(stream >> type >> record.timestamp >> record.value.x >> record.value.y >> record.value.z))
+            continue;
+
+        if (type == 'g')
+            record.type = SENSOR_GYROSCOPE;
+        else if (type == 'a')
+            record.type = SENSOR_ACCELEROMETER;
+        else if (type == 'm')
+            record.type = SENSOR_MAGNETOMETER;
+        else
+            continue;
+
+        records.push_back(record);
+    }
+
+    return true;
+}
+
+void writeSensorRecord(std::ostream &stream, const SensorRecord &record) {
+    static const char types[] = {'g', 'a', 'm'};
+    stream << types[record.type] << ' ' << record.timestamp << ' ' << record.value.x << ' ' << record.value.y
+           << ' ' << record.value.z << '\n';
+}
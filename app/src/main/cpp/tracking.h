@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <atomic>
+
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#define GLM_FORCE_DEFAULT_ALIGNED_GENTYPES
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+enum SensorType {
+    SENSOR_GYROSCOPE,
+    SENSOR_ACCELEROMETER,
+    SENSOR_MAGNETOMETER,
+};
+
+struct SensorRecord {
+    SensorType type;
+    int64_t timestamp;
+    glm::vec3 value;
+};
+
+// Head frame is +X left, +Y forward, +Z up, orientation maps it into the world frame
+struct HeadTracker {
+    glm::quat orientation;
+    glm::vec3 angularVelocity;
+    glm::vec3 integralError;
+    glm::vec3 gravity;
+    glm::vec3 magneticField;
+    glm::vec3 magneticReference;
+    int64_t timestamp;
+    int64_t gravityTimestamp;
+    int64_t magneticTimestamp;
+    float proportionalGain;
+    float integralGain;
+    float magneticGain;
+    bool initialized;
+    bool hasReference;
+};
+
+// Extrapolates the tracked orientation with smoothed angular velocity and acceleration
+struct PosePredictor {
+    glm::vec3 angularVelocity;
+    glm::vec3 angularAcceleration;
+    int64_t timestamp;
+    float velocityTimeConstant;
+    float accelerationTimeConstant;
+    float accelerationWeight;
+    float maximumHorizon;
+    bool initialized;
+};
+
+// Lock-free ring between exactly one producing and one consuming thread, full rings drop new records
+struct SensorQueue {
+    static const uint32_t capacity = 1024;
+    SensorRecord records[capacity];
+    alignas(64) std::atomic<uint32_t> head;
+    alignas(64) std::atomic<uint32_t> tail;
+};
+
+void resetTracker(HeadTracker &tracker);
+void updateTracker(HeadTracker &tracker, const SensorRecord &record);
+glm::vec3 deviceToHead(const glm::vec3 &vector);
+
+void resetPredictor(PosePredictor &predictor);
+void updatePredictor(PosePredictor &predictor, const HeadTracker &tracker);
+glm::quat predictOrientation(const HeadTracker &tracker, const PosePredictor &predictor, float horizon);
+float benchmarkPredictor(const std::vector<SensorRecord> &records, const PosePredictor &settings, float horizon);
+
+void resetSensorQueue(SensorQueue &queue);
+bool pushSensorRecord(SensorQueue &queue, const SensorRecord &record);
+bool popSensorRecord(SensorQueue &queue, SensorRecord &record);
+
+bool readSensorLog(const std::string &path, std::vector<SensorRecord> &records);
+void writeSensorRecord(std::ostream &stream, const SensorRecord &record);
@@ -0,0 +1,579 @@
+#include "trajectory.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static uint32_t readWord(const TrajectoryFile &file, uint64_t offset) {
+    uint32_t word;
+    memcpy(&word, file.mapping + offset, sizeof(uint32_t));
+    return file.swapped ? __builtin_bswap32(word) : word;
+}
+
+static float readFloat(const TrajectoryFile &file, uint64_t offset) {
+    uint32_t word = readWord(file, offset);
+    float value;
+    memcpy(&value, &word, sizeof(float));
+    return value;
+}
+
+static bool openDcd(TrajectoryFile &file) {
+    if (file.size < 100)
+        return false;
+
+    file.swapped = false;
+    if (readWord(file, 0) != 84) {
+        file.swapped = true;
+        if (readWord(file, 0) != 84)
+            return false;
+    }
+
+    if (memcmp(file.mapping + 4, "CORD", 4) != 0 || readWord(file, 88) != 84)
+        return false;
+
+    bool charmm = readWord(file, 84) != 0;
+    uint32_t fixedCount = readWord(file, 40);
+    file.timestep = charmm ? readFloat(file, 44) : 0.0f;
+    file.hasUnitCell = charmm && readWord(file, 48) != 0;
+    file.hasFourthDimension = charmm && readWord(file, 52) != 0;
+
+    if (fixedCount != 0)
+        return false;
+
+    uint64_t offset = 92;
+    uint32_t titleSize = readWord(file, offset);
+    offset += titleSize + 8;
+
+    if (offset + 12 > file.size || readWord(file, offset) != 4)
+        return false;
+
+    file.atomCount = readWord(file, offset + 4);
+    offset += 12;
+
+    uint64_t axisSize = 8 + 4 * (uint64_t) file.atomCount;
+    uint64_t frameSize = 3 * axisSize + (file.hasUnitCell ? 56 : 0) +
+            (file.hasFourthDimension ? axisSize : 0);
+
+    file.frameOffsets.clear();
+    for (; offset + frameSize <= file.size; offset += frameSize)
+        file.frameOffsets.push_back(offset);
+
+    return file.atomCount > 0 && !file.frameOffsets.empty();
+}
+
+static bool decodeDcd(const TrajectoryFile &file, uint32_t frame, float *positions) {
+    uint64_t offset = file.frameOffsets[frame] + (file.hasUnitCell ? 56 : 0);
+    uint32_t axisSize = 4 * file.atomCount;
+
+    for (uint32_t axis = 0; axis < 3; axis++) {
+        if (readWord(file, offset) != axisSize || readWord(file, offset + 4 + axisSize) != axisSize)
+            return false;
+
+        const uint8_t *data = file.mapping + offset + 4;
+        for (uint32_t atom = 0; atom < file.atomCount; atom++) {
+            uint32_t word;
+            memcpy(&word, data + 4 * atom, sizeof(uint32_t));
+            if (file.swapped)
+                word = __builtin_bswap32(word);
+            memcpy(&positions[atom * 3 + axis], &word, sizeof(float));
+        }
+
+        offset += axisSize + 8;
+    }
+
+    return true;
+}
+
+static const uint32_t xtcMagic = 1995;
+static const uint32_t xtcHeaderSize = 56;
+static const uint32_t xtcFirstIndex = 9;
+
+static const uint32_t xtcMagicInts[] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 8, 10, 12, 16, 20, 25, 32, 40, 50, 64,
+        80, 101, 128, 161, 203, 256, 322, 406, 512, 645, 812, 1024, 1290,
+        1625, 2048, 2580, 3250, 4096, 5060, 6501, 8192, 10321, 13003,
+        16384, 20642, 26007, 32768, 41285, 52015, 65536, 82570, 104031,
+        131072, 165140, 208063, 262144, 330280, 416127, 524287, 660561,
+        832255, 1048576, 1321122, 1664510, 2097152, 2642245, 3329021,
+        4194304, 5284491, 6658042, 8388607, 10568983, 13316085, 16777216
+};
+
+static const uint32_t xtcLastIndex = sizeof(xtcMagicInts) / sizeof(uint32_t);
+
+struct XtcIndexHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t fileSize;
+    int64_t modified;
+    uint64_t frameCount;
+};
+
+struct BitReader {
+    const uint8_t *data;
+    const uint8_t *end;
+    uint64_t buffer;
+    int32_t count;
+};
+
+static inline uint32_t readBits(BitReader &reader, int32_t bitCount) {
+    if (reader.count < bitCount) {
+        while (reader.count <= 56) {
+            reader.buffer = (reader.buffer << 8) | (reader.data < reader.end ? *reader.data : 0);
+            reader.data++;
+            reader.count += 8;
+        }
+    }
+
+    reader.count -= bitCount;
+    return (uint32_t) (reader.buffer >> reader.count) & (uint32_t) ((1ull << bitCount) - 1);
+}
+
+static uint32_t bitSize(uint32_t size) {
+    uint32_t bits = 0;
+    while (bits < 32 && size >= (1u << bits))
+        bits++;
+    return bits;
+}
+
+static uint32_t bitSize(const uint32_t sizes[3]) {
+    uint32_t bytes[32] = {1};
+    uint32_t byteCount = 1;
+    for (uint32_t index = 0; index < 3; index++) {
+        uint32_t carry = 0;
+        for (uint32_t byte = 0; byte < byteCount; byte++) {
+            uint64_t value = (uint64_t) bytes[byte] * sizes[index] + carry;
+            bytes[byte] = value & 0xff;
+            carry = value >> 8;
+        }
+        while (carry != 0) {
+            bytes[byteCount++] = carry & 0xff;
+            carry >>= 8;
+        }
+    }
+
+    return (byteCount - 1) * 8 + bitSize(bytes[byteCount - 1]);
+}
+
+// Decodes three mixed radix digits packed into bitCount bits, least significant byte first
+static inline void readInts(BitReader &reader, uint32_t bitCount, const uint32_t sizes[3], int32_t values[3]) {
+    if (bitCount <= 32) {
+        uint32_t value = 0;
+        uint32_t shift = 0;
+        for (; bitCount > 8; bitCount -= 8, shift += 8)
+            value |= readBits(reader, 8) << shift;
+        if (bitCount > 0)
+            value |= readBits(reader, bitCount) << shift;
+
+        values[2] = value % sizes[2];
+        value /= sizes[2];
+        values[1] = value % sizes[1];
+        values[0] = value / sizes[1];
+        return;
+    }
+
+    if (bitCount <= 64) {
+        uint64_t value = 0;
+        uint32_t shift = 0;
+        for (; bitCount > 8; bitCount -= 8, shift += 8)
+            value |= (uint64_t) readBits(reader, 8) << shift;
+        value |= (uint64_t) readBits(reader, bitCount) << shift;
+
+        values[2] = value % sizes[2];
+        value /= sizes[2];
+        values[1] = value % sizes[1];
+        values[0] = value / sizes[1];
+        return;
+    }
+
+    uint32_t bytes[32];
+    uint32_t byteCount = 0;
+    for (; bitCount > 8; bitCount -= 8)
+        bytes[byteCount++] = readBits(reader, 8);
+    bytes[byteCount++] = readBits(reader, bitCount);
+
+    for (uint32_t index = 2; index > 0; index--) {
+        uint32_t remainder = 0;
+        for (uint32_t byte = byteCount; byte > 0; byte--) {
+            uint32_t value = (remainder << 8) | bytes[byte - 1];
+            bytes[byte - 1] = value / sizes[index];
+            remainder = value % sizes[index];
+        }
+        values[index] = remainder;
+    }
+
+    values[0] = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (bytes[3] << 24);
+}
+
+static uint64_t xtcFrameSize(const TrajectoryFile &file, uint64_t offset) {
+    if (offset + xtcHeaderSize > file.size || readWord(file, offset) != xtcMagic)
+        return 0;
+
+    uint32_t atomCount = readWord(file, offset + 4);
+    if (atomCount != file.atomCount)
+        return 0;
+    if (atomCount <= 9)
+        return xtcHeaderSize + 12 * (uint64_t) atomCount;
+
+    if (offset + xtcHeaderSize + 36 > file.size)
+        return 0;
+
+    uint64_t byteCount = readWord(file, offset + xtcHeaderSize + 32);
+    return xtcHeaderSize + 36 + ((byteCount + 3) & ~3ull);
+}
+
+static bool readXtcIndex(TrajectoryFile &file, const std::string &path, int64_t modified) {
+    FILE *index = fopen(path.c_str(), "rb");
+    if (!index)
+        return false;
+
+    XtcIndexHeader header{};
+    // A frame takes at least its header, so any larger count comes from a corrupt index
+    bool valid = fread(&header, sizeof(header), 1, index) == 1 && memcmp(header.magic, "MVRX", 4) == 0 &&
+            header.version == 1 && header.fileSize == file.size && header.modified == modified &&
+            header.frameCount <= file.size / xtcHeaderSize;
+
+    if (valid) {
+        file.frameOffsets.resize(header.frameCount);
+        valid = fread(file.frameOffsets.data(), sizeof(uint64_t), header.frameCount, index) == header.frameCount;
+    }
+
+    fclose(index);
+
+    for (uint64_t frame = 0; valid && frame < file.frameOffsets.size(); frame++) {
+        uint64_t offset = file.frameOffsets[frame];
+        valid = xtcFrameSize(file, offset) != 0 && offset + xtcFrameSize(file, offset) <= file.size;
+    }
+
+    if (!valid)
+        file.frameOffsets.clear();
+
+    return valid && !file.frameOffsets.empty();
+}
+
+static void writeXtcIndex(const TrajectoryFile &file, const std::string &path, int64_t modified) {
+    std::string temporary = path + ".tmp";
+    FILE *index = fopen(temporary.c_str(), "wb");
+    if (!index)
+        return;
+
+    XtcIndexHeader header{{'M', 'V', 'R', 'X'}, 1, file.size, modified, file.frameOffsets.size()};
+    bool written = fwrite(&header, sizeof(header), 1, index) == 1 &&
+            fwrite(file.frameOffsets.data(), sizeof(uint64_t), file.frameOffsets.size(), index) == file.frameOffsets.size();
+
+    if (fclose(index) == 0 && written)
+        rename(temporary.c_str(), path.c_str());
+    else
+        remove(temporary.c_str());
+}
+
+static bool openXtc(TrajectoryFile &file, const std::string &path, int64_t modified) {
+    if (file.size < xtcHeaderSize)
+        return false;
+
+    file.swapped = false;
+    if (readWord(file, 0) != xtcMagic) {
+        file.swapped = true;
+        if (readWord(file, 0) != xtcMagic)
+            return false;
+    }
+
+    file.atomCount = readWord(file, 4);
+    file.timestep = 0.0f;
+    file.hasUnitCell = true;
+    file.hasFourthDimension = false;
+
+    if (file.atomCount == 0)
+        return false;
+
+    std::string indexPath = path + ".idx";
+    if (!readXtcIndex(file, indexPath, modified)) {
+        file.frameOffsets.clear();
+        for (uint64_t offset = 0, frameSize; (frameSize = xtcFrameSize(file, offset)) != 0 &&
+                offset + frameSize <= file.size; offset += frameSize)
+            file.frameOffsets.push_back(offset);
+
+        if (file.frameOffsets.empty())
+            return false;
+
+        writeXtcIndex(file, indexPath, modified);
+    }
+
+    if (file.frameOffsets.size() > 1)
+        file.timestep = readFloat(file, file.frameOffsets[1] + 12) - readFloat(file, file.frameOffsets[0] + 12);
+
+    return true;
+}
+
+static bool decodeXtc(const TrajectoryFile &file, uint32_t frame, float *positions) {
+    uint64_t offset = file.frameOffsets[frame] + xtcHeaderSize;
+    uint32_t atomCount = file.atomCount;
+
+    if (atomCount <= 9) {
+        for (uint32_t index = 0; index < 3 * atomCount; index++)
+            positions[index] = readFloat(file, offset + 4 * index);
+        return true;
+    }
+
+    float precision = readFloat(file, offset);
+    int32_t minimum[3], maximum[3];
+    uint32_t sizes[3];
+    for (uint32_t axis = 0; axis < 3; axis++) {
+        minimum[axis] = (int32_t) readWord(file, offset + 4 + 4 * axis);
+        maximum[axis] = (int32_t) readWord(file, offset + 16 + 4 * axis);
+        int64_t range = (int64_t) maximum[axis] - minimum[axis] + 1;
+        if (range <= 0 || range > UINT32_MAX || !(precision > 0.0f))
+            return false;
+        sizes[axis] = (uint32_t) range;
+    }
+
+    uint32_t largeBits[3] = {};
+    uint32_t largeBitCount = 0;
+    bool largeInts = sizes[0] > 0xffffff || sizes[1] > 0xffffff || sizes[2] > 0xffffff;
+    if (largeInts) {
+        for (uint32_t axis = 0; axis < 3; axis++)
+            largeBits[axis] = bitSize(sizes[axis]);
+    } else {
+        largeBitCount = bitSize(sizes);
+    }
+
+    uint32_t smallIndex = readWord(file, offset + 28);
+    uint64_t byteCount = readWord(file, offset + 32);
+    if (smallIndex < xtcFirstIndex || smallIndex >= xtcLastIndex ||
+            offset + 36 + byteCount > file.size)
+        return false;
+
+    uint32_t smaller = xtcMagicInts[std::max(xtcFirstIndex, smallIndex - 1)] / 2;
+    uint32_t smallNumber = xtcMagicInts[smallIndex] / 2;
+
+    BitReader reader{file.mapping + offset + 36, file.mapping + offset + 36 + byteCount, 0, 0};
+    float inversePrecision = 1.0f / precision;
+    float *output = positions;
+    float *last = positions + 3 * atomCount;
+    uint32_t run = 0;
+
+    while (output < last) {
+        int32_t current[3];
+        if (largeInts) {
+            for (uint32_t axis = 0; axis < 3; axis++)
+                current[axis] = (int32_t) readBits(reader, largeBits[axis]);
+        } else {
+            readInts(reader, largeBitCount, sizes, current);
+        }
+        for (uint32_t axis = 0; axis < 3; axis++)
+            current[axis] += minimum[axis];
+
+        int32_t isSmaller = 0;
+        if (readBits(reader, 1)) {
+            run = readBits(reader, 5);
+            isSmaller = (int32_t) (run % 3) - 1;
+            run -= run % 3;
+        }
+
+        if (output + 3 + run > last)
+            return false;
+
+        if (run > 0) {
+            uint32_t smallSizes[3] = {xtcMagicInts[smallIndex], xtcMagicInts[smallIndex], xtcMagicInts[smallIndex]};
+            for (uint32_t index = 0; index < run; index += 3) {
+                int32_t next[3];
+                readInts(reader, smallIndex, smallSizes, next);
+                for (uint32_t axis = 0; axis < 3; axis++)
+                    next[axis] += current[axis] - (int32_t) smallNumber;
+
+                // The first small atom is stored ahead of the large one it was encoded against
+                for (uint32_t axis = 0; axis < 3; axis++)
+                    *output++ = next[axis] * inversePrecision;
+                if (index == 0)
+                    for (uint32_t axis = 0; axis < 3; axis++)
+                        *output++ = current[axis] * inversePrecision;
+
+                for (uint32_t axis = 0; axis < 3; axis++)
+                    current[axis] = next[axis];
+            }
+        } else {
+            for (uint32_t axis = 0; axis < 3; axis++)
+                *output++ = current[axis] * inversePrecision;
+        }
+
+        smallIndex += isSmaller;
+        if (smallIndex < xtcFirstIndex || smallIndex >= xtcLastIndex)
+            return false;
+
+        if (isSmaller < 0) {
+            smallNumber = smaller;
+            smaller = smallIndex > xtcFirstIndex ? xtcMagicInts[smallIndex - 1] / 2 : 0;
+        } else if (isSmaller > 0) {
+            smaller = smallNumber;
+            smallNumber = xtcMagicInts[smallIndex] / 2;
+        }
+    }
+
+    return output == last;
+}
+
+bool openTrajectory(const std::string &path, TrajectoryFile &file) {
+    file.descriptor = open(path.c_str(), O_RDONLY);
+    if (file.descriptor < 0)
+        return false;
+
+    struct stat status{};
+    if (fstat(file.descriptor, &status) != 0 || status.st_size <= 0) {
+        close(file.descriptor);
+        file.descriptor = -1;
+        return false;
+    }
+    file.size = status.st_size;
+
+    void *mapping = mmap(nullptr, file.size, PROT_READ, MAP_PRIVATE, file.descriptor, 0);
+    if (mapping == MAP_FAILED) {
+        close(file.descriptor);
+        file.descriptor = -1;
+        return false;
+    }
+    file.mapping = (const uint8_t *) mapping;
+
+    file.format = TRAJECTORY_DCD;
+    if (openDcd(file))
+        return true;
+
+    file.format = TRAJECTORY_XTC;
+    if (openXtc(file, path, status.st_mtime))
+        return true;
+
+    closeTrajectory(file);
+    return false;
+}
+
+void closeTrajectory(TrajectoryFile &file) {
+    if (file.mapping)
+        munmap((void *) file.mapping, file.size);
+    if (file.descriptor >= 0)
+        close(file.descriptor);
+
+    file.mapping = nullptr;
+    file.descriptor = -1;
+    file.frameOffsets.clear();
+}
+
+bool decodeFrame(const TrajectoryFile &file, uint32_t frame, float *positions) {
+    if (frame >= file.frameOffsets.size())
+        return false;
+
+    if (file.format == TRAJECTORY_XTC)
+        return decodeXtc(file, frame, positions);
+
+    return decodeDcd(file, frame, positions);
+}
+
+static void decodeFrames(TrajectoryPlayer *player) {
+    std::unique_lock<std::mutex> lock(player->mutex);
+
+    while (true) {
+        player->condition.wait(lock, [player] {
+            return !player->running || !player->freeSlots.empty();
+        });
+        if (!player->running)
+            break;
+
+        uint32_t frame = player->nextFrame;
+        uint32_t slot = player->freeSlots.front();
+        uint64_t sequence = player->nextSequence++;
+        player->freeSlots.pop_front();
+        player->nextFrame = (frame + 1) % player->file.frameOffsets.size();
+        lock.unlock();
+
+        bool decoded = decodeFrame(player->file, frame, player->slots[slot]);
+
+        lock.lock();
+        if (sequence >= player->readySequence) {
+            player->decodedFrames[sequence] = {frame, slot, decoded};
+        } else {
+            player->freeSlots.push_back(slot);
+            player->condition.notify_one();
+        }
+    }
+}
+
+void startPlayer(TrajectoryPlayer &player, const std::vector<float *> &slots, uint32_t workerCount) {
+    player.slots = slots;
+    player.freeSlots.clear();
+    player.decodedFrames.clear();
+    for (uint32_t slot = 0; slot < slots.size(); slot++)
+        player.freeSlots.push_back(slot);
+
+    player.nextFrame = 0;
+    player.nextSequence = 0;
+    player.readySequence = 0;
+    player.running = true;
+
+    player.threads.clear();
+    for (uint32_t worker = 0; worker < std::max(workerCount, 1u); worker++)
+        player.threads.emplace_back(decodeFrames, &player);
+}
+
+void stopPlayer(TrajectoryPlayer &player) {
+    {
+        std::lock_guard<std::mutex> lock(player.mutex);
+        player.running = false;
+    }
+    player.condition.notify_all();
+
+    for (auto &thread : player.threads)
+        thread.join();
+    player.threads.clear();
+}
+
+void seekPlayer(TrajectoryPlayer &player, uint32_t frame) {
+    {
+        std::lock_guard<std::mutex> lock(player.mutex);
+        player.readySequence = player.nextSequence;
+        player.nextFrame = frame % player.file.frameOffsets.size();
+        for (auto &decoded : player.decodedFrames)
+            player.freeSlots.push_back(decoded.second.slot);
+        player.decodedFrames.clear();
+    }
+    player.condition.notify_all();
+}
+
+bool acquireFrame(TrajectoryPlayer &player, TrajectoryFrame &frame) {
+    bool recycled = false;
+    std::unique_lock<std::mutex> lock(player.mutex);
+
+    // Frames are handed out in claim order, a failed decode is skipped instead of stalling playback
+    while (true) {
+        auto decoded = player.decodedFrames.find(player.readySequence);
+        if (decoded == player.decodedFrames.end())
+            break;
+
+        frame = decoded->second;
+        player.decodedFrames.erase(decoded);
+        player.readySequence++;
+
+        if (frame.valid) {
+            lock.unlock();
+            if (recycled)
+                player.condition.notify_all();
+            return true;
+        }
+
+        player.freeSlots.push_back(frame.slot);
+        recycled = true;
+    }
+
+    lock.unlock();
+    if (recycled)
+        player.condition.notify_all();
+    return false;
+}
+void releaseFrame(TrajectoryPlayer &player, uint32_t slot) {
+    {
+        std::lock_guard<std::mutex> lock(player.mutex);
+        player.freeSlots.push_back(slot);
+    }
+    player.condition.notify_all();
+}
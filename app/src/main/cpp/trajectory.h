@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+enum TrajectoryFormat {
+    TRAJECTORY_DCD,
+    TRAJECTORY_XTC,
+};
+
+struct TrajectoryFile {
+    TrajectoryFormat format;
+    int descriptor;
+    const uint8_t *mapping;
+    size_t size;
+    uint32_t atomCount;
+    float timestep;
+    bool swapped;
+    bool hasUnitCell;
+    bool hasFourthDimension;
+    std::vector<uint64_t> frameOffsets;
+};
+
+struct TrajectoryFrame {
+    uint32_t frame;
+    uint32_t slot;
+    bool valid;
+};
+
+struct TrajectoryPlayer {
+    TrajectoryFile file;
+    std::vector<float *> slots;
+    std::deque<uint32_t> freeSlots;
+    std::map<uint64_t, TrajectoryFrame> decodedFrames;
+    uint32_t nextFrame;
+    uint64_t nextSequence;
+    uint64_t readySequence;
+    bool running;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable condition;
+};
+
+bool openTrajectory(const std::string &path, TrajectoryFile &file);
+void closeTrajectory(TrajectoryFile &file);
+bool decodeFrame(const TrajectoryFile &file, uint32_t frame, float *positions);
+
+void startPlayer(TrajectoryPlayer &player, const std::vector<float *> &slots,
+                 uint32_t workerCount);
+void stopPlayer(TrajectoryPlayer &player);
+void seekPlayer(TrajectoryPlayer &player, uint32_t frame);
+bool acquireFrame(TrajectoryPlayer &player, TrajectoryFrame &frame);
+void releaseFrame(TrajectoryPlayer &player, uint32_t slot);
@@ -0,0 +1,129 @@
+#include "vertexformat.h"
+
+#include <cfloat>
+#include <cstring>
+
+#include <glm/gtc/packing.hpp>
+
+static VkFormat encodingFormat(VertexEncoding encoding) {
+    switch (encoding) {
+        case ENCODING_FLOAT:
+            return VK_FORMAT_R32G32B32_SFLOAT;
+        case ENCODING_HALF:
+            return VK_FORMAT_R16G16B16A16_SFLOAT;
+        case ENCODING_QUANTIZED:
+            return VK_FORMAT_R16G16B16A16_UNORM;
+        case ENCODING_OCTAHEDRAL:
+            return VK_FORMAT_R16G16_SNORM;
+        case ENCODING_PALETTE8:
+            return VK_FORMAT_R8_UINT;
+        case ENCODING_PALETTE16:
+            return VK_FORMAT_R16_UINT;
+    }
+    return VK_FORMAT_UNDEFINED;
+}
+
+static uint32_t encodingSize(VertexEncoding encoding) {
+    switch (encoding) {
+        case ENCODING_FLOAT:
+            return 3 * sizeof(float);
+        case ENCODING_HALF:
+        case ENCODING_QUANTIZED:
+            return 4 * sizeof(uint16_t);
+        case ENCODING_OCTAHEDRAL:
+            return 2 * sizeof(uint16_t);
+        case ENCODING_PALETTE8:
+            return sizeof(uint8_t);
+        case ENCODING_PALETTE16:
+            return sizeof(uint16_t);
+    }
+    return 0;
+}
+
+// Unit vectors fold onto the octahedron, the lower half mirrored over its diagonals
+static glm::vec2 octahedral(const glm::vec3 &normal) {
+    glm::vec3 folded = normal / glm::max(glm::abs(normal.x) + glm::abs(normal.y) + glm::abs(normal.z), FLT_MIN);
+    glm::vec2 encoded(folded.x, folded.y);
+    if (folded.z < 0.0f)
+        encoded = (1.0f - glm::abs(glm::vec2(folded.y, folded.x))) *
+                  glm::vec2(folded.x >= 0.0f ? 1.0f : -1.0f, folded.y >= 0.0f ? 1.0f : -1.0f);
+    return encoded;
+}
+
+VertexLayout createVertexLayout(const std::vector<VertexElement> &elements) {
+    VertexLayout layout{elements, 0, glm::vec3(0.0f), glm::vec3(1.0f)};
+
+    for (auto &element : layout.elements) {
+        element.offset = layout.stride;
+        layout.stride += (encodingSize(element.encoding) + 3) / 4 * 4;
+    }
+
+    return layout;
+}
+
+void quantizeVertexLayout(VertexLayout &layout, const glm::vec3 &minimum, const glm::vec3 &maximum) {
+    layout.offset = glm::vec3(0.0f);
+    layout.scale = glm::vec3(1.0f);
+
+    for (auto &element : layout.elements)
+        if (element.attribute == ATTRIBUTE_POSITION && element.encoding == ENCODING_QUANTIZED) {
+            layout.offset = minimum;
+            layout.scale = glm::max(maximum - minimum, glm::vec3(FLT_MIN));
+        }
+}
+
+void vertexAttributes(const VertexLayout &layout, uint32_t binding,
+                      std::vector<VkVertexInputAttributeDescription> &attributes) {
+    for (auto &element : layout.elements)
+        attributes.push_back({element.location, binding, encodingFormat(element.encoding), element.offset});
+}
+
+void encodeVertex(const VertexLayout &layout, const VertexValues &values, uint8_t *destination) {
+    for (auto &element : layout.elements) {
+        uint8_t *target = destination + element.offset;
+        glm::vec3 vector = element.attribute == ATTRIBUTE_NORMAL ? values.normal : values.position;
+
+        if (element.encoding == ENCODING_FLOAT) {
+            memcpy(target, &vector.x, 3 * sizeof(float));
+        } else if (element.encoding == ENCODING_HALF) {
+            uint64_t packed = glm::packHalf4x16(glm::vec4(vector, 1.0f));
+            memcpy(target, &packed, sizeof(packed));
+        } else if (element.encoding == ENCODING_QUANTIZED) {
+            glm::vec3 normalized = glm::clamp((vector - layout.offset) / layout.scale, 0.0f, 1.0f);
+            uint64_t packed = glm::packUnorm4x16(glm::vec4(normalized, 1.0f));
+            memcpy(target, &packed, sizeof(packed));
+        } else if (element.encoding == ENCODING_OCTAHEDRAL) {
+            uint32_t packed = glm::packSnorm2x16(octahedral(vector));
+            memcpy(target, &packed, sizeof(packed));
+        } else if (element.encoding == ENCODING_PALETTE8) {
+            *target = (uint8_t) values.color;
+        } else if (element.encoding == ENCODING_PALETTE16) {
+            uint16_t index = values.color;
+            memcpy(target, &index, sizeof(index));
+        }
+    }
+}
+
+uint32_t paletteIndex(ColorPalette &palette, const glm::vec3 &color) {
+    uint32_t key = glm::packUnorm4x8(glm::vec4(color, 1.0f));
+    auto found = palette.indices.find(key);
+    if (found != palette.indices.end())
+        return found->second;
+
+    if (palette.colors.size() < palette.capacity) {
+        palette.indices[key] = palette.colors.size();
+        palette.colors.push_back(glm::unpackUnorm4x8(key));
+        return palette.colors.size() - 1;
+    }
+
+    uint32_t nearest = 0;
+    float nearestDistance = FLT_MAX;
+    for (uint32_t i = 0; i < palette.colors.size(); i++) {
+        glm::vec3 difference = glm::vec3(palette.colors[i]) - color;
+        if (glm::dot(difference, difference) < nearestDistance) {
+            nearestDistance = glm::dot(difference, difference);
+            nearest = i;
+        }
+    }
+    return nearest;
+}
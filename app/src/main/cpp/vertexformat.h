@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+
+#include <vulkan/vulkan.h>
+
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#define GLM_FORCE_DEFAULT_ALIGNED_GENTYPES
+
+#include <glm/glm.hpp>
+
+enum VertexAttribute {
+    ATTRIBUTE_POSITION,
+    ATTRIBUTE_NORMAL,
+    ATTRIBUTE_COLOR,
+};
+
+enum VertexEncoding {
+    ENCODING_FLOAT,
+    ENCODING_HALF,
+    ENCODING_QUANTIZED,
+    ENCODING_OCTAHEDRAL,
+    ENCODING_PALETTE8,
+    ENCODING_PALETTE16,
+};
+
+// Offsets are assigned in declaration order, every element starts on a four byte boundary
+struct VertexElement {
+    VertexAttribute attribute;
+    uint32_t location;
+    VertexEncoding encoding;
+    uint32_t offset;
+};
+
+// Quantized positions decode as offset + value * scale, the other encodings keep an identity transform
+struct VertexLayout {
+    std::vector<VertexElement> elements;
+    uint32_t stride;
+    glm::vec3 offset;
+    glm::vec3 scale;
+};
+
+struct VertexValues {
+    glm::vec3 position;
+    glm::vec3 normal;
+    uint32_t color;
+};
+
+// Colors are deduplicated at 8 bits per channel, once full the nearest existing entry is reused
+struct ColorPalette {
+    std::vector<glm::vec4> colors;
+    std::unordered_map<uint32_t, uint32_t> indices;
+    uint32_t capacity;
+};
+
+VertexLayout createVertexLayout(const std::vector<VertexElement> &elements);
+void quantizeVertexLayout(VertexLayout &layout, const glm::vec3 &minimum, const glm::vec3 &maximum);
+void vertexAttributes(const VertexLayout &layout, uint32_t binding,
+                      std::vector<VkVertexInputAttributeDescription> &attributes);
+void encodeVertex(const VertexLayout &layout, const VertexValues &values, uint8_t *destination);
+uint32_t paletteIndex(ColorPalette &palette, const glm::vec3 &color);
@@ -0,0 +1,67 @@
+#version 460 core
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(constant_id = 0) const uint fragmentLists = 0u;
+layout(constant_id = 1) const int sampleCount = 2;
+
+layout(input_attachment_index = 0, binding = 2) uniform subpassInputMS accumulation;
+layout(input_attachment_index = 1, binding = 3) uniform subpassInputMS revealage;
+
+layout(binding = 4, r32ui) uniform readonly uimage2D fragmentHeads;
+
+layout(binding = 5) readonly buffer Fragments {
+    uint fragmentCount;
+    uvec4 fragments[];
+};
+
+layout(location = 0) out vec4 outColor;
+
+const uint sortLimit = 16u;
+const uint listEnd = 0xFFFFFFFFu;
+
+// Sorts the fragments of this pixel back to front and blends them over each other
+vec4 resolveList() {
+    uvec2 layers[sortLimit];
+    uint count = 0u;
+
+    for (uint index = imageLoad(fragmentHeads, ivec2(gl_FragCoord.xy)).r; index != listEnd && count < sortLimit;
+         index = fragments[index].z) {
+        uvec2 layer = fragments[index].xy;
+        uint j = count++;
+        for (; j > 0u && uintBitsToFloat(layers[j - 1u].y) < uintBitsToFloat(layer.y); j--)
+            layers[j] = layers[j - 1u];
+        layers[j] = layer;
+    }
+
+    vec3 color = vec3(0.0);
+    float transmittance = 1.0;
+    for (uint i = 0u; i < count; i++) {
+        vec4 layer = unpackUnorm4x8(layers[i].x);
+        color = layer.rgb * layer.a + color * (1.0 - layer.a);
+        transmittance *= 1.0 - layer.a;
+    }
+
+    return vec4(color, 1.0 - transmittance);
+}
+
+// Samples are averaged, the composite is blended over every sample of the opaque colour alike
+void main() {
+    vec4 coverage;
+    if (fragmentLists != 0u) {
+        coverage = resolveList();
+        coverage.rgb /= max(coverage.a, 1e-5);
+    } else {
+        vec4 sum = vec4(0.0);
+        float revealed = 0.0;
+        for (int i = 0; i < sampleCount; i++) {
+            sum += subpassLoad(accumulation, i);
+            revealed += subpassLoad(revealage, i).r;
+        }
+        coverage = vec4(sum.rgb / max(sum.a, 1e-5), 1.0 - revealed / float(sampleCount));
+    }
+
+    if (coverage.a <= 0.0)
+        discard;
+
+    outColor = coverage;
+}
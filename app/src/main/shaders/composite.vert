@@ -0,0 +1,7 @@
+#version 460 core
+#extension GL_ARB_separate_shader_objects : enable
+
+// Single triangle covering the render area
+void main() {
+    gl_Position = vec4(vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2) * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,29 @@
+#version 460 core
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(early_fragment_tests) in;
+
+layout(location = 0) in vec4 fragColor;
+
+layout(location = 0) out vec4 outAccumulation;
+layout(location = 1) out float outRevealage;
+
+layout(binding = 4, r32ui) uniform coherent uimage2D fragmentHeads;
+
+layout(binding = 5) buffer Fragments {
+    uint fragmentCount;
+    uvec4 fragments[];
+};
+
+// Per-pixel linked list of colour, depth and next index, fragments past the capacity are dropped
+void main() {
+    uint index = atomicAdd(fragmentCount, 1u);
+    if (index < uint(fragments.length())) {
+        uint next = imageAtomicExchange(fragmentHeads, ivec2(gl_FragCoord.xy), index);
+        fragments[index] = uvec4(packUnorm4x8(fragColor), floatBitsToUint(gl_FragCoord.z), next, 0u);
+    }
+
+    // Neutral under the accumulation blend state
+    outAccumulation = vec4(0.0);
+    outRevealage = 0.0;
+}
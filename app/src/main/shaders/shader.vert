@@ -6,23 +6,54 @@ layout(binding = 0) uniform Transform {
     mat4 left;
     mat4 right;
     mat4 proj;
+    uvec4 playback;
+    vec4 keyframe;
 } transform;
 
-layout(location = 0) in vec3 inPosition;
-layout(location = 1) in vec3 inColor;
+layout(binding = 1) readonly buffer Positions {
+    float positions[];
+};
+
+layout(binding = 6) readonly buffer Palette {
+    vec4 palette[];
+};
+
+// Quantized positions decode against the bounds of the buffer being drawn
+layout(push_constant) uniform Draw {
+    vec4 offset;
+    vec4 scale;
+    vec4 highlight;
+    uint animated;
+    float opacity;
+    uint eye;
+} draw;
 
-layout(location = 0) out vec3 fragColor;
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in uint inColor;
+layout(location = 2) in mat4 inInstance;
+layout(location = 6) in float inOcclusion;
 
-layout(constant_id = 0) const float eyeConstant = 0.0f;
+layout(location = 0) out vec4 fragColor;
 
 void main() {
-    if (eyeConstant < 0.0f) {
-        gl_Position = transform.proj * transform.left * transform.model * vec4(inPosition, 1.0);
-    }
+    vec3 position = draw.offset.xyz + inPosition * draw.scale.xyz;
 
-    if (eyeConstant > 0.0f) {
-        gl_Position = transform.proj * transform.right * transform.model * vec4(inPosition, 1.0);
+    // Animated draws carry how many vertices each atom has, slot zero of the positions is the structure at rest
+    if (draw.animated != 0u && transform.playback.w != 0u) {
+        uint atom = uint(gl_VertexIndex) / draw.animated;
+        uint rest = atom * 3u;
+        uint from = (transform.playback.x * transform.playback.y + atom) * 3u;
+        uint to = (transform.playback.z * transform.playback.y + atom) * 3u;
+        position += mix(vec3(positions[from], positions[from + 1u], positions[from + 2u]),
+                        vec3(positions[to], positions[to + 1u], positions[to + 2u]), transform.keyframe.x) -
+                    vec3(positions[rest], positions[rest + 1u], positions[rest + 2u]);
     }
 
-    fragColor = inColor;
+    mat4 view = draw.eye == 0u ? transform.left : transform.right;
+    gl_Position = transform.proj * view * transform.model * inInstance * vec4(position, 1.0);
+
+    // Playing trajectories move away from the baked occlusion, the warp pass applies screen-space occlusion instead
+    bool playing = draw.animated != 0u && transform.playback.w != 0u;
+    vec3 color = mix(palette[inColor].rgb, draw.highlight.rgb, draw.highlight.a);
+    fragColor = vec4(color * (playing ? 1.0 : inOcclusion), draw.opacity);
 }
@@ -0,0 +1,16 @@
+#version 460 core
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(early_fragment_tests) in;
+
+layout(location = 0) in vec4 fragColor;
+
+layout(location = 0) out vec4 outAccumulation;
+layout(location = 1) out float outRevealage;
+
+// Weighted blended transparency, nearer and more opaque fragments dominate the average
+void main() {
+    float weight = clamp(fragColor.a * max(1e-2, 3e3 * pow(1.0 - gl_FragCoord.z, 3.0)), 1e-2, 3e3);
+    outAccumulation = vec4(fragColor.rgb * fragColor.a, fragColor.a) * weight;
+    outRevealage = fragColor.a;
+}
@@ -0,0 +1,92 @@
+#version 460 core
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(binding = 0) uniform WarpTransform {
+    mat4 reprojection[2];
+    vec4 foveation;
+    vec4 resolution;
+} warp;
+
+layout(binding = 1) uniform sampler2D eyeColor;
+layout(binding = 2) uniform sampler2DMS eyeDepth;
+layout(binding = 3) uniform sampler2D eyeOcclusion;
+
+layout(location = 0) in vec2 fragRed;
+layout(location = 1) in vec2 fragGreen;
+layout(location = 2) in vec2 fragBlue;
+layout(location = 3) flat in uint fragEye;
+
+layout(location = 0) out vec4 outColor;
+
+// Multi-resolution eye images keep the fovea at full density and pack the periphery at reduced density
+vec2 packFoveated(vec2 ndc) {
+    if (warp.foveation.w == 0.0)
+        return ndc * 0.5 + 0.5;
+
+    vec2 offset = abs(ndc);
+    vec2 packed = min(offset, warp.foveation.x) + max(offset - warp.foveation.x, 0.0) * warp.foveation.y;
+    return sign(ndc) * packed / warp.foveation.z * 0.5 + 0.5;
+}
+
+// Only the top left resolution.x fraction of each eye half was rendered, keep filtering inside it
+vec2 eyeCoordinate(vec2 ndc) {
+    vec2 halfTexel = 0.5 / vec2(textureSize(eyeColor, 0)) * vec2(2.0, 1.0);
+    vec2 packed = clamp(packFoveated(ndc) * warp.resolution.x, halfTexel, warp.resolution.x - halfTexel);
+    return vec2((packed.x + float(fragEye)) * 0.5, packed.y);
+}
+
+float fetchDepth(vec2 ndc) {
+    ivec2 size = textureSize(eyeDepth);
+    ivec2 texel = clamp(ivec2(eyeCoordinate(ndc) * vec2(size)), ivec2(0), size - 1);
+    return texelFetch(eyeDepth, texel, 0).r;
+}
+
+// Bilinear taps of the half resolution occlusion, each weighted down by how far its depth is from ours
+float upsampleOcclusion(vec2 ndc) {
+    if (warp.resolution.y == 0.0 || any(greaterThan(abs(ndc), vec2(1.0))))
+        return 1.0;
+
+    ivec2 size = textureSize(eyeOcclusion, 0);
+    ivec2 depthSize = textureSize(eyeDepth);
+    vec2 coordinate = eyeCoordinate(ndc);
+    float depth = texelFetch(eyeDepth, clamp(ivec2(coordinate * vec2(depthSize)), ivec2(0), depthSize - 1), 0).r;
+    vec2 position = coordinate * vec2(size) - 0.5;
+    vec2 fraction = fract(position);
+    ivec2 base = ivec2(floor(position));
+
+    float visibility = 0.0, total = 0.0;
+    for (int i = 0; i < 4; i++) {
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        ivec2 texel = clamp(base + offset, ivec2(0), size - 1);
+        vec2 bilinear = mix(1.0 - fraction, fraction, vec2(offset));
+
+        // One minus depth is close to near over view distance, so this ratio is a relative depth difference
+        float coarseDepth = texelFetch(eyeDepth, min(texel * 2, depthSize - 1), 0).r;
+        float difference = abs(coarseDepth - depth) / max(1.0 - depth, 1e-6);
+        float weight = bilinear.x * bilinear.y / (1e-3 + difference * 50.0);
+
+        visibility += texelFetch(eyeOcclusion, texel, 0).r * weight;
+        total += weight;
+    }
+
+    return total > 0.0 ? visibility / total : 1.0;
+}
+
+vec4 sampleEye(vec2 ndc) {
+    if (any(greaterThan(abs(ndc), vec2(1.0))))
+        return vec4(0.0);
+    return texture(eyeColor, eyeCoordinate(ndc));
+}
+
+void main() {
+    // First guess uses the depth under the output pixel, then refine with the depth where it landed
+    vec4 source = warp.reprojection[fragEye] * vec4(fragGreen, fetchDepth(fragGreen), 1.0);
+    source /= source.w;
+    source = warp.reprojection[fragEye] * vec4(fragGreen, fetchDepth(source.xy), 1.0);
+    source /= source.w;
+
+    // Dispersion only shifts where each channel is read, so red and blue reuse the green reprojection
+    vec2 offset = source.xy - fragGreen;
+    vec3 color = vec3(sampleEye(fragRed + offset).r, sampleEye(source.xy).g, sampleEye(fragBlue + offset).b);
+    outColor = vec4(color * upsampleOcclusion(source.xy), 1.0);
+}
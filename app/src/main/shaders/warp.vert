@@ -0,0 +1,20 @@
+#version 460 core
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec2 inRed;
+layout(location = 2) in vec2 inGreen;
+layout(location = 3) in vec2 inBlue;
+
+layout(location = 0) out vec2 fragRed;
+layout(location = 1) out vec2 fragGreen;
+layout(location = 2) out vec2 fragBlue;
+layout(location = 3) flat out uint fragEye;
+
+void main() {
+    fragRed = inRed;
+    fragGreen = inGreen;
+    fragBlue = inBlue;
+    fragEye = uint(gl_InstanceIndex);
+    gl_Position = vec4(inPosition, 0.0, 1.0);
+}
@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include "tracking.h"
+#include "latency.h"
+#include "pacing.h"
+
+// Steady yaw of one radian per second at 400 Hz, the phone held level so gravity is along device +X
+static std::vector<SensorRecord> syntheticTrace() {
+    std::vector<SensorRecord> records;
+
+    for (int64_t i = 0; i < 4000; i++) {
+        int64_t timestamp = 1000000000ll + i * 2500000ll;
+        if (i % 4 == 0)
+            records.push_back({SENSOR_ACCELEROMETER, timestamp, glm::vec3(9.80665f, 0.0f, 0.0f)});
+        records.push_back({SENSOR_GYROSCOPE, timestamp, glm::vec3(1.0f, 0.0f, 0.0f)});
+    }
+
+    return records;
+}
+
+static bool check(bool condition, const char *message) {
+    if (!condition)
+        fprintf(stderr, "Check failed: %s\n", message);
+    return condition;
+}
+
+// Every frame line carries nine integers and every summary line a known stage, a count and five ordered figures
+static bool checkLatencyLog(const std::string &path, size_t frames, std::vector<std::string> &summary) {
+    static const char *stageNames[] = {"sensor-pose", "pose-submit", "submit-gpu", "gpu-present", "scene-present",
+                                       "motion-photon"};
+
+    std::ifstream log(path);
+    std::string line;
+    size_t frameLines = 0;
+    bool valid = true;
+
+    while (std::getline(log, line)) {
+        std::istringstream fields(line);
+        std::string tag;
+        fields >> tag;
+
+        if (tag == "f") {
+            int64_t values[9];
+            for (auto &value : values)
+                fields >> value;
+            std::string extra;
+            valid &= check(fields && !(fields >> extra), "frame lines have nine integer fields");
+            valid &= check(values[0] == (int64_t) ++frameLines, "frame lines are numbered in order");
+            valid &= check(summary.empty(), "frame lines come before the summary");
+        } else if (tag == "s") {
+            std::string name, extra;
+            size_t count;
+            double figures[5];
+            fields >> name >> count;
+            for (auto &figure : figures)
+                fields >> figure;
+
+            bool known = false;
+            for (auto stage : stageNames)
+                known |= name == stage;
+            valid &= check(fields && !(fields >> extra), "summary lines have a name, a count and five figures");
+            valid &= check(known, "summary lines name a known stage");
+            valid &= check(count == frames, "summary counts every frame");
+            valid &= check(figures[1] <= figures[2] && figures[2] <= figures[3] && figures[3] <= figures[4],
+                           "summary percentiles are ordered");
+            summary.push_back(line);
+        } else {
+            valid &= check(false, "log lines start with f or s");
+        }
+    }
+
+    valid &= check(frameLines == frames, "every replayed frame is logged");
+    return valid;
+}
+
+// A 120 Hz panel with known phase, deadlines have to land on its vsync grid at the requested rate
+static bool checkPacer() {
+    const int64_t period = 8333333, vsync = 1000000000ll;
+
+    FramePacer pacer;
+    resetPacer(pacer, period, 60);
+    bool valid = check(pacer.interval == 2, "60 Hz on a 120 Hz panel presents every second vsync");
+    resetPacer(pacer, period, 0);
+    valid &= check(pacer.interval == 1, "zero target rate follows the display");
+
+    FrameTiming feedback{};
+    feedback.presentTime = vsync;
+    updatePacer(pacer, feedback);
+    valid &= check(pacer.phaseKnown && pacer.presentedFrames == 0, "feedback without a deadline only sets the phase");
+
+    int64_t now = vsync + period / 3;
+    int64_t start = scheduleFrame(pacer, now);
+    valid &= check((pacer.deadline - vsync) % period == 0, "deadlines snap to the vsync grid");
+    valid &= check(start >= now && pacer.deadline - period < now + pacer.frameWork + pacer.margin,
+                   "the first deadline is the earliest one the frame can make");
+
+    int64_t previous = pacer.deadline;
+    scheduleFrame(pacer, now);
+    valid &= check(pacer.deadline == previous + period, "back to back frames take consecutive vsyncs");
+
+    resetPacer(pacer, period, 60);
+    updatePacer(pacer, feedback);
+    scheduleFrame(pacer, now);
+    previous = pacer.deadline;
+    scheduleFrame(pacer, now);
+    valid &= check(pacer.deadline == previous + 2 * period, "target rate skips vsyncs between deadlines");
+
+    FrameTiming onTime{}, late{};
+    onTime.deadline = late.deadline = previous;
+    onTime.presentTime = previous;
+    late.presentTime = previous + period;
+    updatePacer(pacer, onTime);
+    updatePacer(pacer, late);
+    valid &= check(pacer.presentedFrames == 2 && pacer.missedFrames == 1, "only late presents count as missed");
+
+    return valid;
+}
+
+// Usage: replay [sensors.log [horizon]], without a log a synthetic trace is written and read back
+int main(int argc, char **argv) {
+    std::string path = argc > 1 ? argv[1] : "synthetic.log";
+    float horizon = argc > 2 ? std::strtof(argv[2], nullptr) : 0.05f;
+
+    if (argc <= 1) {
+        std::ofstream log(path);
+        for (auto &record : syntheticTrace())
+            writeSensorRecord(log, record);
+    }
+
+    std::vector<SensorRecord> records;
+    if (!readSensorLog(path, records) || records.empty()) {
+        fprintf(stderr, "Cannot read sensor log %s\n", path.c_str());
+        return 1;
+    }
+
+    PosePredictor settings;
+    resetPredictor(settings);
+    PosePredictor held = settings;
+    held.maximumHorizon = 0.0f;
+
+    float predicted = benchmarkPredictor(records, settings, horizon);
+    float baseline = benchmarkPredictor(records, held, horizon);
+    printf("%zu records, %.0f ms ahead: %.3f degrees predicted, %.3f degrees held\n", records.size(),
+           horizon * 1e3f, glm::degrees(predicted), glm::degrees(baseline));
+
+    // A 60 Hz display latching 8 ms before vsync, the timings are what the app logs on a typical phone
+    LatencyModel model{16666667, 8000000, 2000000, 4000000, 11000000};
+    auto timings = replayLatency(records, model);
+    {
+        std::ofstream log("replay-latency.log");
+        for (auto &timing : timings)
+            writeFrameTiming(log, timing);
+        writeLatencySummary(log, timings);
+    }
+
+    std::vector<std::string> summary;
+    bool formatted = checkLatencyLog("replay-latency.log", timings.size(), summary);
+    for (auto &line : summary)
+        printf("%s\n", line.c_str());
+
+    // The model fixes every stage after the latch, so those lines are exact whatever the trace
+    auto expected = [&summary, &timings](const char *stage, const char *milliseconds) {
+        std::string line = std::string("s ") + stage + ' ' + std::to_string(timings.size());
+        for (int figure = 0; figure < 5; figure++)
+            line += std::string(" ") + milliseconds;
+        return std::find(summary.begin(), summary.end(), line) != summary.end();
+    };
+
+    bool ordered = true;
+    for (auto &timing : timings)
+        ordered &= timing.sensorTime <= timing.poseTime && timing.gpuTime <= timing.presentTime;
+
+    bool passed = checkPacer();
+    passed &= check(std::isfinite(predicted) && std::isfinite(baseline), "errors are finite");
+    passed &= check(!timings.empty(), "replay produces frames");
+    passed &= check(formatted, "latency log has the format the app writes");
+    passed &= check(summary.size() == 6, "latency log summarizes every stage");
+    passed &= check(expected("pose-submit", "2.000") && expected("submit-gpu", "4.000") &&
+                    expected("gpu-present", "2.000") && expected("scene-present", "19.000"),
+                    "summary matches the latency model");
+    passed &= check(ordered, "every frame presents after its sensor sample and GPU work");
+    if (argc <= 1) {
+        passed &= check(records.size() == syntheticTrace().size(), "log round trip keeps every record");
+        passed &= check(baseline > 0.5f * horizon, "holding the pose lags a steady turn");
+        passed &= check(predicted < 0.1f * baseline, "prediction follows a steady turn");
+    }
+
+    return passed ? 0 : 1;
+}